@@ -0,0 +1,109 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+struct JobCounter;
+
+struct Job
+{
+    void (*function)(void *userData, uint32_t index) = nullptr;
+    void *userData = nullptr;
+    uint32_t index = 0;
+    // Decremented once the job has run, may be nullptr
+    JobCounter *counter = nullptr;
+};
+
+// Number of jobs still pending. Jobs submitted with a dependency are parked on it and released when it reaches zero.
+// A counter may only be destroyed after JobSystem::Wait returned for it.
+struct JobCounter
+{
+    std::atomic<uint32_t> pending{0};
+    std::mutex mutex;
+    std::vector<Job> continuations;
+
+    bool IsDone() const { return pending.load(std::memory_order_acquire) == 0; }
+};
+
+// Work-stealing scheduler. Every worker, and the thread that called Init, owns a deque: owners push and pop at the back, idle workers steal from the front of
+// the others. Waiting on a counter runs queued jobs instead of blocking, so jobs may submit and wait on further jobs and the main thread helps while it waits.
+struct JobSystem
+{
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<Job> jobs;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> threads;
+    std::atomic<bool> running{false};
+    std::atomic<int32_t> queuedJobs{0};
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+
+    JobSystem() = default;
+    JobSystem(const JobSystem &) = delete;
+    JobSystem &operator=(const JobSystem &) = delete;
+    ~JobSystem() { Shutdown(); }
+
+    // Starts workerCount threads next to the calling thread, 0 picks one less than the hardware thread count
+    void Init(uint32_t workerCount = 0);
+    void Shutdown();
+    uint32_t GetThreadCount() const { return static_cast<uint32_t>(queues.size()); }
+
+    // Adds count to counter and queues the jobs, or parks them until dependency reaches zero when one is given
+    void Run(const Job *jobs, uint32_t count, JobCounter *counter, JobCounter *dependency = nullptr);
+    // Runs queued jobs until counter reaches zero
+    void Wait(JobCounter *counter);
+
+    // Calls function(begin, end) over [0, count) in batches of grain and returns once all of them ran
+    template <typename Function> void ParallelFor(uint32_t count, uint32_t grain, Function &&function)
+    {
+        struct Context
+        {
+            std::remove_reference_t<Function> *function;
+            uint32_t count;
+            uint32_t grain;
+        } context{&function, count, grain == 0 ? 1 : grain};
+        uint32_t batchCount = (count + context.grain - 1) / context.grain;
+        if (batchCount <= 1 || queues.size() <= 1)
+        {
+            if (count > 0)
+            {
+                function(0u, count);
+            }
+            return;
+        }
+
+        JobCounter counter;
+        std::vector<Job> jobs(batchCount);
+        for (uint32_t i = 0; i < batchCount; ++i)
+        {
+            jobs[i].function = [](void *userData, uint32_t index)
+            {
+                Context *context = static_cast<Context *>(userData);
+                uint32_t begin = index * context->grain;
+                uint32_t end = begin + context->grain < context->count ? begin + context->grain : context->count;
+                (*context->function)(begin, end);
+            };
+            jobs[i].userData = &context;
+            jobs[i].index = i;
+        }
+        Run(jobs.data(), batchCount, &counter);
+        Wait(&counter);
+    }
+
+    uint32_t GetQueueIndex() const;
+    void Push(const Job &job);
+    bool TryRunOne(uint32_t queueIndex);
+    void Execute(const Job &job);
+    void WorkerMain(uint32_t queueIndex);
+};
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <glm/gtx/quaternion.hpp>
+#include <ttc/render/pose.hpp>
+#include <ttc/render/tracks.hpp>
+#include <tth/core/errno.hpp>
+#include <vector>
+
+// Storage of every baked component, the value is the size in bytes
+enum class BakeFormat : uint32_t
+{
+    UNORM8 = 1,
+    UNORM16 = 2,
+    FLOAT32 = 4,
+};
+
+// Clip resampled at a fixed rate. Sampling is a direct frame index and one lerp/nlerp between two neighbouring frames, independent of the source key layout.
+// A frame holds the translations of translationTracks followed by the rotations of rotationTracks, quantized translations use a per-track range and
+// quantized rotations the fixed [-1, 1] range. Rotations are kept on one hemisphere from frame to frame, so neighbouring frames always blend the short way.
+struct BakedClip
+{
+    float duration = 0.0f;
+    float frameRate = 0.0f;
+    uint32_t frameCount = 0;
+    BakeFormat format = BakeFormat::FLOAT32;
+
+    std::vector<uint64_t> boneCRC64;
+    std::vector<uint32_t> translationTracks;
+    std::vector<uint32_t> rotationTracks;
+    std::vector<glm::vec3> translationMin;
+    std::vector<glm::vec3> translationScale;
+
+    size_t frameStride = 0;
+    std::vector<uint8_t> frames;
+
+    size_t GetTrackCount() const { return boneCRC64.size(); }
+    size_t GetMemoryUsage() const;
+    float GetFrameTime(uint32_t frame) const { return std::min((float)frame / frameRate, duration); }
+
+    // Same contract as AnimationTracks::Sample, constant tracks and tracks without keys of a kind leave the corresponding output untouched
+    void Sample(float time, glm::vec3 *outTranslations, glm::quat *outRotations) const;
+    void Clear();
+};
+
+// Resamples tracks at frameRate frames per second. The last frame is taken at the end of the clip, so unless the duration is a whole number of frames
+// it follows the frame before it by less than 1 / frameRate.
+TTH::errno_t BakeTracks(const AnimationTracks &tracks, float frameRate, BakeFormat format, BakedClip &clip);
+
+// Local and global transforms of every skeleton bone at every output frame, frame f of bone b lives at [f * boneCount + b] in skeleton order.
+// Frames are spaced like the ones of BakedClip, the last one sits at the end of the clip.
+struct BakedPoses
+{
+    float duration = 0.0f;
+    float frameRate = 0.0f;
+    uint32_t frameCount = 0;
+    size_t boneCount = 0;
+    std::vector<glm::mat4> localTransforms;
+    std::vector<glm::mat4> globalTransforms;
+
+    const glm::mat4 *GetLocalTransforms(uint32_t frame) const { return localTransforms.data() + frame * boneCount; }
+    const glm::mat4 *GetGlobalTransforms(uint32_t frame) const { return globalTransforms.data() + frame * boneCount; }
+    float GetFrameTime(uint32_t frame) const { return std::min((float)frame / frameRate, duration); }
+    // Blends the local transforms of the two frames around time into pose, in the order of hierarchy, which has to be the one the poses were baked on.
+    // Globals have to be composed from pose again, blending them directly would not keep children attached to their parents.
+    void Sample(float time, const SkeletonHierarchy &hierarchy, LocalPose &pose) const;
+    void Clear();
+};
+
+// Evaluates tracks on hierarchy at frameRate frames per second in a single forward sweep over the keys, so the cost is O(keys + frames * bones).
+// Every frame covers the whole skeleton, bones a cut down hierarchy leaves out stay at the identity.
+TTH::errno_t BakePoses(const AnimationTracks &tracks, const SkeletonHierarchy &hierarchy, float frameRate, BakedPoses &poses);
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <ttc/render/pose.hpp>
+#include <ttc/render/posestage.hpp>
+#include <ttc/render/tracks.hpp>
+#include <tth/core/errno.hpp>
+#include <tth/d3dmesh/d3dmesh.hpp>
+#include <tth/skeleton/skeleton.hpp>
+#include <vector>
+
+// Mesh parts skinned by one skeleton. The character owns a single pose instance, so its pose is evaluated once per frame and every part draws with the
+// same bone palette no matter how many parts there are. Only the bones the parts' BlendIndex streams reference, and their ancestors, are evaluated.
+struct Character
+{
+    SkeletonHierarchy hierarchy;
+    BoneBinding boneBinding;
+    // Skeleton bones referenced by any part, in skeleton order
+    std::vector<bool> usedBones;
+    // hierarchy cut down to the used bones and their ancestors, this is what the pose stage evaluates
+    SkeletonHierarchy evaluatedHierarchy;
+    BoneBinding evaluatedBinding;
+    // Inverse of every bone's rest pose global transform in skeleton order, computed once in Build
+    std::vector<glm::mat4> inverseBindMatrices;
+    // Meshes have to be skinned against the character's skeleton and outlive the character
+    std::vector<const TTH::D3DMesh *> parts;
+    uint32_t poseInstance = 0;
+
+    size_t GetBoneCount() const { return hierarchy.GetBoneCount(); }
+    size_t GetPartCount() const { return parts.size(); }
+
+    // Flattens skeleton and binds it to the clip's tracks. Fails with -EINVAL when the skeleton is not a tree.
+    TTH::errno_t Build(const TTH::Skeleton &skeleton, const AnimationTracks &tracks);
+    // Marks the bones mesh's BlendIndex streams reference as used, has to come after Build
+    void AddPart(const TTH::D3DMesh &mesh);
+    // Registers the character's pose instance on stage, tracks have to be the ones the character was built with. Parts added later do not widen the
+    // evaluated bones. Without any BlendIndex stream every bone is evaluated.
+    uint32_t AddToStage(PoseStage &stage, const AnimationTracks &tracks);
+    // Global bone transforms in skeleton order, valid after the stage's update for the frame
+    const glm::mat4 *GetBonePalette(const PoseStage &stage) const { return stage.GetGlobalTransforms(poseInstance); }
+    void Clear();
+};
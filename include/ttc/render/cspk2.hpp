@@ -0,0 +1,120 @@
+#pragma once
+
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <glm/gtx/quaternion.hpp>
+#include <tth/animation/animation.hpp>
+#include <tth/core/errno.hpp>
+#include <ttc/render/tracks.hpp>
+#include <vector>
+
+typedef TTH::CompressedSkeletonPoseKeys2::Header CSPK2Header;
+
+// Samples are packed in blocks of 4 per key kind, a block stays staged until all of its samples were consumed. Unpacked samples are x, y, z and,
+// for quaternions, w rebuilt from the unit length.
+struct CSPK2Blocks
+{
+    uint32_t stagedDelQ = 4;
+    uint32_t stagedAbsQ = 4;
+    uint32_t stagedDelV = 4;
+    uint32_t stagedAbsV = 4;
+    float delQ[4][4];
+    float absQ[4][4];
+    float delV[4][4];
+    float absV[4][4];
+};
+
+struct CSPK2SeekIndex;
+
+// Resumable CSPK2 decoder for clips too large to expand up front. The bitstream cursor, the staged 4-sample blocks and the last two keys of every bone
+// survive between calls, so forward playback only decodes the keys between the previous and the current time. Going backwards, or jumping ahead past a
+// checkpoint of the seek index, restores the nearest checkpoint, without an index it rewinds to the start of the stream.
+// Keys are ordered by the time of the key before them in their bone, so once every key up to a time is decoded, each bone already holds the key after it and
+// sampling interpolates exactly like AnimationTracks::Sample.
+struct CSPK2Stream
+{
+    CSPK2Header header{};
+    float duration = 0.0f;
+    std::vector<uint64_t> boneCRC64;
+
+    const uint8_t *sampleBegin = nullptr;
+    const uint8_t *sampleData = nullptr;
+    const uint8_t *sampleEnd = nullptr;
+    const uint32_t *keyBegin = nullptr;
+    const uint32_t *key = nullptr;
+    const uint32_t *keyEnd = nullptr;
+    float decodedTime = -1.0f;
+
+    CSPK2Blocks blocks;
+    // Optional, lets seeks restore the nearest checkpoint instead of decoding from the start
+    const CSPK2SeekIndex *seekIndex = nullptr;
+
+    // Last decoded key of every bone in stream bone order, a time below zero means the bone has no key yet
+    std::vector<glm::vec3> translations;
+    std::vector<float> translationTimes;
+    std::vector<glm::quat> rotations;
+    std::vector<float> rotationTimes;
+    // Key decoded before the last one, a time below zero means the bone has at most one key yet
+    std::vector<glm::vec3> previousTranslations;
+    std::vector<float> previousTranslationTimes;
+    std::vector<glm::quat> previousRotations;
+    std::vector<float> previousRotationTimes;
+
+    // The stream only points into cspk, which has to outlive it
+    TTH::errno_t Open(const TTH::CompressedSkeletonPoseKeys2 &cspk, float clipDuration);
+    void Close();
+    void Rewind();
+
+    size_t GetBoneCount() const { return boneCRC64.size(); }
+    size_t GetKeyCount() const { return keyEnd - keyBegin; }
+    // Time of the key before the one under the cursor in its bone, -1 when there is none. Never decreases along the stream.
+    float GetCursorTime() const;
+
+    // Decodes the key under the cursor and moves past it
+    TTH::errno_t DecodeKey();
+    // Decodes every key whose predecessor in its bone is at or before time
+    TTH::errno_t Advance(float time);
+    // Restores the last checkpoint at or before time, or rewinds when there is none. Does not decode.
+    void Seek(float time);
+    // Writes every bone at the time of the last Advance, interpolated between its last two keys. Bones before their first key hold it, bones without a key
+    // of a kind leave the corresponding output untouched.
+    void Sample(glm::vec3 *outTranslations, glm::quat *outRotations) const;
+};
+
+// Fills in the bone table and the key count of every track without expanding any key, for clips that are sampled through stream instead. The key arrays
+// stay empty and no track is listed as animated, so tracks only tell which bones have keys of a kind.
+TTH::errno_t DescribeCSPK2(const CSPK2Stream &stream, AnimationTracks &tracks);
+// Expands a CompressedSkeletonPoseKeys2 bitstream into tracks, one track per animated bone in the order of the stream's bone table
+TTH::errno_t DecodeCSPK2(const TTH::CompressedSkeletonPoseKeys2 &cspk, float duration, AnimationTracks &tracks);
+
+// Decoder state snapshot, the per-bone keys live in the index's flat arrays at [index * boneCount, (index + 1) * boneCount)
+struct CSPK2Checkpoint
+{
+    // Time the stream is decoded through, the cursor time of the last key before the checkpoint. Increases along the stream, unlike key times.
+    float time;
+    uint32_t keyOffset;
+    uint32_t sampleOffset;
+    CSPK2Blocks blocks;
+};
+
+// Built once per clip by decoding the whole stream and snapshotting the decoder every keyInterval keys or timeInterval seconds, whichever comes first.
+// A seek then costs at most one interval of decoding.
+struct CSPK2SeekIndex
+{
+    std::vector<CSPK2Checkpoint> checkpoints;
+    size_t boneCount = 0;
+    std::vector<glm::vec3> translations;
+    std::vector<float> translationTimes;
+    std::vector<glm::quat> rotations;
+    std::vector<float> rotationTimes;
+    std::vector<glm::vec3> previousTranslations;
+    std::vector<float> previousTranslationTimes;
+    std::vector<glm::quat> previousRotations;
+    std::vector<float> previousRotationTimes;
+
+    TTH::errno_t Build(const TTH::CompressedSkeletonPoseKeys2 &cspk, float duration, uint32_t keyInterval, float timeInterval);
+    void Clear();
+    // Last checkpoint at or before time, nullptr when time is before the first one
+    const CSPK2Checkpoint *Find(float time) const;
+    size_t GetMemoryUsage() const;
+};
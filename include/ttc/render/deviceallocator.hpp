@@ -0,0 +1,142 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <set>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+// What an allocation is used for, only feeds the statistics
+enum class MemoryCategory : uint32_t
+{
+    Vertex,
+    Index,
+    Indirect,
+    Uniform,
+    Storage,
+    Staging,
+    Depth,
+    Other,
+    Count,
+};
+
+// Range of a VkDeviceMemory handed out by DeviceAllocator. id names it to Free, 0 means nothing is allocated.
+struct MemoryAllocation
+{
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkDeviceSize offset = 0;
+    VkDeviceSize size = 0;
+    // Points at offset when the memory is host visible, blocks stay mapped for their whole life
+    uint8_t *mapped = nullptr;
+    uint32_t memoryType = 0;
+    uint32_t id = 0;
+};
+
+// Planned by Defragment. to is already allocated, the caller copies the contents over, binds a new resource to it and frees from.
+struct DefragmentMove
+{
+    MemoryAllocation from;
+    MemoryAllocation to;
+};
+
+struct MemoryCategoryStats
+{
+    uint64_t allocationCount = 0;
+    uint64_t bytes = 0;
+};
+
+// Sub-allocates buffers and images from a few large VkDeviceMemory blocks per memory type, so the number of device allocations stays far below
+// maxMemoryAllocationCount no matter how many resources get loaded. Free ranges of a block are found with a two level segregated fit (TLSF): the first
+// level is the power of two at or below the range's size, the second splits that power of two into SL_COUNT bins. Requests above half a block get a
+// block of their own. Buffers and optimal images only share a bufferImageGranularity page when the device allows it.
+struct DeviceAllocator
+{
+    static constexpr uint32_t SL_LOG2 = 3;
+    static constexpr uint32_t SL_COUNT = 1u << SL_LOG2;
+    static constexpr uint32_t FL_COUNT = 64;
+
+    struct Segment
+    {
+        VkDeviceSize size = 0;
+        uint32_t id = 0; // 0 while the segment is free
+        bool linear = true;
+    };
+    struct Block
+    {
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        VkDeviceSize size = 0;
+        VkDeviceSize used = 0;
+        uint8_t *mapped = nullptr;
+        uint32_t memoryType = 0;
+        // Holds a single request larger than half a block, released as soon as it is freed
+        bool dedicated = false;
+        // Covers the whole block in offset order, free segments never touch each other
+        std::map<VkDeviceSize, Segment> segments;
+        // Offsets of the free segments in bin fl * SL_COUNT + sl, a set bit marks a non-empty bin
+        std::vector<std::set<VkDeviceSize>> bins;
+        uint64_t firstLevel = 0;
+        std::array<uint32_t, FL_COUNT> secondLevel{};
+    };
+    struct Record
+    {
+        uint32_t block = 0;
+        VkDeviceSize offset = 0;
+        VkDeviceSize size = 0;
+        VkDeviceSize alignment = 1;
+        MemoryCategory category = MemoryCategory::Other;
+        bool linear = true;
+        // Buffers can be moved by Defragment, images are left in place
+        bool movable = false;
+    };
+
+    VkPhysicalDeviceMemoryProperties memProperties{};
+    VkDeviceSize bufferImageGranularity = 1;
+    VkDeviceSize nonCoherentAtomSize = 1;
+    uint32_t maxMemoryAllocationCount = 4096;
+    // Blocks on heaps smaller than eight times this get an eighth of the heap instead
+    VkDeviceSize preferredBlockSize = VkDeviceSize(64) << 20;
+
+    // Released blocks leave a null slot behind so block indices in records stay valid
+    std::vector<std::unique_ptr<Block>> blocks;
+    // Indexed by id, records[0] is unused
+    std::vector<Record> records;
+    std::vector<uint32_t> freeIds;
+    uint32_t deviceAllocationCount = 0;
+    std::array<MemoryCategoryStats, static_cast<size_t>(MemoryCategory::Count)> categoryStats{};
+
+    void Init(VkPhysicalDevice physicalDevice);
+    // Frees every block, whatever is still allocated from them becomes invalid
+    void Destroy(VkDevice device);
+
+    // Host visible memory that is not coherent gets its offset and size rounded to nonCoherentAtomSize, so flushing whole atoms never reaches a neighbor
+    VkResult Allocate(VkDevice device, const VkMemoryRequirements &requirements, VkMemoryPropertyFlags properties, MemoryCategory category, bool linear, bool movable,
+                      MemoryAllocation &out);
+    // Allocate followed by binding the resource at the allocation's offset
+    VkResult AllocateBuffer(VkDevice device, VkBuffer buffer, VkMemoryPropertyFlags properties, MemoryCategory category, MemoryAllocation &out);
+    VkResult AllocateImage(VkDevice device, VkImage image, VkImageTiling tiling, VkMemoryPropertyFlags properties, MemoryCategory category, MemoryAllocation &out);
+    // Resets allocation, empty blocks are released unless they are the last one of their memory type
+    void Free(VkDevice device, MemoryAllocation &allocation);
+
+    // Moves buffer allocations out of the emptiest blocks of every memory type into fuller ones, up to maxBytes in total. Blocks emptied this way are
+    // released once the caller frees the moved allocations. A block that receives a move is never a source in the same pass, so every from still
+    // holds its data and the moves can be copied in any order, e.g. all in one command buffer.
+    // Nothing in the renderer calls this yet: its buffers are created once at load and live until shutdown, so there is nothing to compact. A caller
+    // has to create a new buffer for every move, bind it to to, copy the contents over, point descriptors and recorded commands at it, and only then
+    // free from.
+    std::vector<DefragmentMove> Defragment(VkDeviceSize maxBytes);
+
+    MemoryCategoryStats GetCategoryStats(MemoryCategory category) const { return categoryStats[static_cast<size_t>(category)]; }
+    void LogStats() const;
+
+    VkDeviceSize GetBlockSize(uint32_t memoryType) const;
+    VkResult CreateBlock(VkDevice device, uint32_t memoryType, VkDeviceSize size, bool dedicated, uint32_t &blockIndex);
+    void ReleaseBlock(VkDevice device, uint32_t blockIndex);
+    // Places size bytes in blockIndex, false when no free segment fits them
+    bool AllocateFromBlock(uint32_t blockIndex, VkDeviceSize size, VkDeviceSize alignment, bool linear, VkDeviceSize &offset);
+    uint32_t AddRecord(const Record &record);
+    MemoryAllocation Describe(uint32_t id) const;
+    void InsertFree(Block &block, VkDeviceSize offset, VkDeviceSize size);
+    void RemoveFree(Block &block, VkDeviceSize offset, VkDeviceSize size);
+};
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+#include <ttc/render/deviceallocator.hpp>
+#include <vulkan/vulkan.h>
+
+// Persistently mapped buffer split into one region per frame in flight. Per-frame data is written straight into the mapped memory and bound with dynamic
+// offsets, so it needs no copy, submit or semaphore before the frame's draw. A region may only be reused once the fence of the frame that last used it
+// has signaled.
+struct FrameRing
+{
+    VkBuffer buffer = VK_NULL_HANDLE;
+    MemoryAllocation allocation;
+    uint8_t *mapped = nullptr;
+    VkDeviceSize frameSize = 0;
+    uint32_t frameCount = 0;
+    // Writes to memory that is not host coherent have to be flushed before the submit
+    bool coherent = true;
+    bool deviceLocal = false;
+    VkDeviceSize nonCoherentAtomSize = 1;
+
+    uint32_t frame = 0;
+    VkDeviceSize head = 0;
+
+    // Prefers device local host visible memory so the GPU reads it without crossing the bus, falls back to plain host visible memory
+    VkResult Init(VkDevice device, DeviceAllocator &allocator, VkDeviceSize frameSize, uint32_t frameCount, VkBufferUsageFlags usage);
+    void Destroy(VkDevice device, DeviceAllocator &allocator);
+
+    // Starts handing out memory from the region of frame, everything allocated from it before is dropped
+    void BeginFrame(uint32_t frame);
+    // Returns where to write size bytes and their offset within buffer, nullptr when the frame's region is full
+    void *Allocate(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize &offset);
+    // Makes everything allocated since BeginFrame visible to the device
+    VkResult Flush(VkDevice device) const;
+};
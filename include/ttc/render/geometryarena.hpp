@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+#include <ttc/render/uploadmanager.hpp>
+#include <tth/d3dmesh/d3dmesh.hpp>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+// Where a mesh ended up in the arena, in the units vkCmdDrawIndexed and VkDrawIndexedIndirectCommand take
+struct ArenaMesh
+{
+    uint32_t firstIndex = 0;
+    int32_t vertexOffset = 0;
+    uint32_t indexCount = 0;
+    uint32_t vertexCount = 0;
+};
+
+// Layout of many meshes packed into one index buffer and one vertex buffer. Vertex stream j of every mesh lives in one region of the vertex buffer, so
+// binding each region once serves every mesh and a draw only differs in firstIndex and vertexOffset. Meshes have to share their vertex layout.
+// Indices stay local to their mesh, they are widened to 32 bits for everyone as soon as one mesh needs 32 bit indices.
+struct GeometryArena
+{
+    std::vector<ArenaMesh> meshes;
+    // Byte offset and vertex stride of each stream's region in the vertex buffer
+    std::vector<VkDeviceSize> streamOffsets;
+    std::vector<uint32_t> streamStrides;
+    VkIndexType indexType = VkIndexType::VK_INDEX_TYPE_UINT16;
+    VkDeviceSize indexSize = 0;
+    VkDeviceSize vertexSize = 0;
+
+    // Lays out meshes in order, returns false when their vertex streams differ
+    bool Build(const TTH::D3DMesh *const *meshes, size_t meshCount);
+    // Queues the indices and vertices of the same meshes Build was given for copying into buffers of at least indexSize and vertexSize bytes
+    VkResult Upload(VkDevice device, const TTH::D3DMesh *const *meshes, UploadManager &uploads, VkBuffer indexBuffer, VkBuffer vertexBuffer) const;
+};
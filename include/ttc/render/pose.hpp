@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <ttc/render/posekernel.hpp>
+#include <ttc/render/tracks.hpp>
+#include <tth/core/errno.hpp>
+#include <tth/skeleton/skeleton.hpp>
+#include <vector>
+
+// Maps every skeleton bone to the track that animates it. Only depends on the skeleton and the clip, so one binding is shared by every instance playing the clip.
+struct BoneBinding
+{
+    static constexpr int32_t UNANIMATED = -1;
+
+    std::vector<int32_t> trackIndices;
+
+    void Build(const uint64_t *boneCRC64, size_t boneCount, const uint64_t *trackCRC64, size_t trackCount);
+    void Build(const uint64_t *boneCRC64, size_t boneCount, const AnimationTracks &tracks);
+    void Build(const TTH::Skeleton &skeleton, const AnimationTracks &tracks);
+};
+
+// Skeleton flattened once at load. Bones are reordered by depth so parents always come before their children and every depth level is a contiguous range,
+// level l owns [levelOffsets[l], levelOffsets[l + 1]). All arrays are indexed in that flat order, skeletonIndices maps back to the skeleton's own order.
+// A hierarchy cut down with Subset keeps only some of the skeleton's bones, skeletonBoneCount stays the size of the whole skeleton.
+struct SkeletonHierarchy
+{
+    size_t skeletonBoneCount = 0;
+    std::vector<uint32_t> skeletonIndices;
+    std::vector<int32_t> parents;
+    std::vector<uint64_t> boneCRC64;
+    std::vector<uint32_t> levelOffsets;
+    LocalPose restPose;
+
+    size_t GetBoneCount() const { return skeletonIndices.size(); }
+    size_t GetLevelCount() const { return levelOffsets.empty() ? 0 : levelOffsets.size() - 1; }
+    size_t GetMaxLevelSize() const;
+
+    // Fails with -EINVAL on parent indices outside the skeleton or cycles
+    TTH::errno_t Build(const TTH::Skeleton &skeleton);
+    // Copies the bones with keep[i] set, in flat order, together with all their ancestors into out
+    void Subset(const std::vector<bool> &keep, SkeletonHierarchy &out) const;
+    void Clear();
+    // Local to global in place, one batched pass per level. scratch needs room for GetMaxLevelSize() matrices.
+    void ComposeGlobals(glm::mat4 *transforms, glm::mat4 *scratch) const;
+};
+
+// Writes the sampled track values into pose for every animated bone of hierarchy, binding has to be built against hierarchy.boneCRC64.
+// Unanimated bones are left as they are. Sampled translations are unit directions scaled by the length of the bone's rest translation, bones whose track
+// has no translation keys keep their rest translation.
+void ApplySampledPose(const SkeletonHierarchy &hierarchy, const BoneBinding &binding, const AnimationTracks &tracks, const glm::vec3 *sampledTranslations,
+                      const glm::quat *sampledRotations, LocalPose &pose);
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <glm/gtx/quaternion.hpp>
+#include <vector>
+
+// Local bone transforms as structure-of-arrays so whole groups of bones fit in one vector register
+struct LocalPose
+{
+    std::vector<float> tx, ty, tz;
+    std::vector<float> qx, qy, qz, qw;
+
+    size_t GetBoneCount() const { return tx.size(); }
+    void Resize(size_t boneCount);
+    void Set(size_t bone, const glm::vec3 &translation, const glm::quat &rotation)
+    {
+        tx[bone] = translation.x;
+        ty[bone] = translation.y;
+        tz[bone] = translation.z;
+        qx[bone] = rotation.x;
+        qy[bone] = rotation.y;
+        qz[bone] = rotation.z;
+        qw[bone] = rotation.w;
+    }
+};
+
+// out[i] = translate(t[first + i]) * toMat4(q[first + i]). Converts 8 bones per iteration with AVX2, 4 with SSE, scalar otherwise.
+void BuildLocalMatrices(const LocalPose &pose, size_t first, size_t count, glm::mat4 *out);
+
+// out[i] = a[i] * b[i]. out may alias b.
+void MultiplyMatrices(const glm::mat4 *a, const glm::mat4 *b, size_t count, glm::mat4 *out);
+
+// Writes the first three rows of every affine matrix row by row, 12 floats per matrix. The dropped row is always (0, 0, 0, 1).
+void PackAffineRows(const glm::mat4 *m, size_t count, float *out);
+
+// Turns local transforms into global ones in place. Level l owns bones [levelOffsets[l], levelOffsets[l + 1]), level 0 holds the roots and every other bone's
+// parent lives in an earlier level. scratch needs room for the largest level.
+void ComposeGlobals(const int32_t *parents, const uint32_t *levelOffsets, size_t levelCount, glm::mat4 *transforms, glm::mat4 *scratch);
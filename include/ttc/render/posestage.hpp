@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <ttc/core/job.hpp>
+#include <ttc/render/bake.hpp>
+#include <ttc/render/cspk2.hpp>
+#include <ttc/render/pose.hpp>
+#include <ttc/render/tracks.hpp>
+#include <vector>
+
+enum class LoopMode : uint32_t
+{
+    LOOP,
+    CLAMP,
+    PING_PONG,
+};
+
+// One skeleton playing one clip. Hierarchy, clip and binding are shared between instances and have to outlive the stage, binding has to be built against
+// hierarchy->boneCRC64 and the clip's tracks.
+struct PoseInstance
+{
+    const SkeletonHierarchy *hierarchy = nullptr;
+    const AnimationTracks *tracks = nullptr;
+    // Sampled instead of tracks when set, has to be baked from tracks
+    const BakedClip *bakedClip = nullptr;
+    // Blended instead of sampling tracks when set, see BakedPoses::Sample. Has to be baked from tracks on hierarchy.
+    const BakedPoses *bakedPoses = nullptr;
+    // Decoded while playing instead of sampling tracks when set, tracks then only describe the stream's bones (see DescribeCSPK2). The stream keeps
+    // the decoder position of this instance, so it can not be shared with another one.
+    CSPK2Stream *stream = nullptr;
+    const BoneBinding *binding = nullptr;
+    // Set once stream fails to decode, the instance then keeps the last pose it evaluated
+    bool holdPose = false;
+
+    float time = 0.0f;
+    float playRate = 1.0f;
+    LoopMode loopMode = LoopMode::LOOP;
+    TrackSampler sampler;
+
+    // First matrix of the instance in the stage's arena, the instance owns hierarchy->skeletonBoneCount of them
+    size_t poseOffset = 0;
+
+    // Time within the clip the current playback time maps to
+    float GetClipTime() const;
+};
+
+// Evaluates the global bone transforms of every instance each frame, instances are split into batches across the job system's workers.
+// Poses are written to one arena in skeleton bone order. Its base is cache-line aligned and a mat4 fills exactly one line, so no two instances share a line.
+struct PoseStage
+{
+    static constexpr size_t CACHE_LINE_SIZE = 64;
+    static constexpr uint32_t INSTANCES_PER_JOB = 4;
+
+    std::vector<PoseInstance> instances;
+    glm::mat4 *arena = nullptr;
+    size_t arenaSize = 0;
+    size_t arenaCapacity = 0;
+
+    PoseStage() = default;
+    PoseStage(const PoseStage &) = delete;
+    PoseStage &operator=(const PoseStage &) = delete;
+    ~PoseStage() { Clear(); }
+
+    // Pointers returned by GetGlobalTransforms are invalidated by adding instances
+    uint32_t AddInstance(const SkeletonHierarchy &hierarchy, const AnimationTracks &tracks, const BoneBinding &binding);
+    void Clear();
+
+    // Advances every instance by deltaTime scaled by its play rate and evaluates its pose, runs inline when jobSystem is nullptr
+    void Update(float deltaTime, JobSystem *jobSystem);
+    const glm::mat4 *GetGlobalTransforms(uint32_t instance) const { return arena + instances[instance].poseOffset; }
+};
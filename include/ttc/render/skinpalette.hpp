@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <vector>
+
+// Contiguous run of bones [first, first + count)
+struct BoneRange
+{
+    uint32_t first;
+    uint32_t count;
+};
+
+// Skinning matrices that are only recomputed for bones whose global transform moved. Every upload slot (one per frame in flight) remembers the update
+// it was last written at, so writing a slot only touches the bones that changed since then.
+struct SkinPalette
+{
+    // Global transforms the skinning matrices were last computed from
+    std::vector<glm::mat4> globals;
+    std::vector<glm::mat4> skinningMatrices;
+    // Update in which each bone last changed, bones that never changed keep 0
+    std::vector<uint64_t> changedAt;
+    // Update each slot was last written at
+    std::vector<uint64_t> writtenAt;
+    std::vector<BoneRange> ranges;
+    uint64_t update = 0;
+
+    // Bones left untouched by the last Update and the last Write, and the totals since Reset
+    uint32_t skippedBones = 0;
+    uint32_t skippedUploads = 0;
+    uint64_t totalBones = 0;
+    uint64_t totalSkippedBones = 0;
+    uint64_t totalSkippedUploads = 0;
+
+    size_t GetBoneCount() const { return skinningMatrices.size(); }
+    // Marks every bone dirty in every slot
+    void Reset(size_t boneCount, uint32_t slotCount);
+    // skinningMatrices[i] = newGlobals[i] * inverseBindMatrices[i] for every bone whose global transform differs from the last update
+    void Update(const glm::mat4 *newGlobals, const glm::mat4 *inverseBindMatrices);
+    // Packs the bones slot is missing into out with PackAffineRows, out holds the slot's previous contents. Returns the ranges that were written.
+    const std::vector<BoneRange> &Write(uint32_t slot, float *out);
+};
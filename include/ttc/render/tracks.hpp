@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <glm/gtx/quaternion.hpp>
+#include <tth/animation/animation.hpp>
+#include <vector>
+
+// Animation clip decoded once into per-bone tracks. Keys of every track are stored back to back, track t owns [translationOffsets[t], translationOffsets[t + 1])
+// of translationTimes/translations and [rotationOffsets[t], rotationOffsets[t + 1]) of rotationTimes/rotations.
+// Tracks with a single key are constant and never sampled, their value sits in baseTranslations/baseRotations next to the defaults of tracks without keys.
+struct AnimationTracks
+{
+    float duration = 0.0f;
+
+    std::vector<uint64_t> boneCRC64;
+
+    std::vector<uint32_t> translationOffsets;
+    std::vector<float> translationTimes;
+    std::vector<glm::vec3> translations;
+
+    std::vector<uint32_t> rotationOffsets;
+    std::vector<float> rotationTimes;
+    std::vector<glm::quat> rotations;
+
+    // Value of every track before sampling, outputs passed to Sample start as a copy of these
+    std::vector<glm::vec3> baseTranslations;
+    std::vector<glm::quat> baseRotations;
+    // Tracks with more than one key, the only ones Sample touches
+    std::vector<uint32_t> animatedTranslationTracks;
+    std::vector<uint32_t> animatedRotationTracks;
+
+    size_t GetTrackCount() const { return boneCRC64.size(); }
+    bool HasTranslation(size_t track) const { return translationOffsets[track + 1] > translationOffsets[track]; }
+    bool HasRotation(size_t track) const { return rotationOffsets[track + 1] > rotationOffsets[track]; }
+
+    // Samples every animated track at time, constant tracks and tracks without keys of a kind leave the corresponding output untouched
+    void Sample(float time, glm::vec3 *outTranslations, glm::quat *outRotations) const;
+    // Rebuilds the base values and animated track lists from the keys, has to be called whenever the keys change
+    void FindAnimatedTracks();
+    void Clear();
+};
+
+struct TrackFoldStats
+{
+    // Translation and rotation tracks that have keys
+    size_t keyedTracks = 0;
+    // Tracks sampled every frame before and after folding
+    size_t animatedBefore = 0;
+    size_t animatedAfter = 0;
+};
+
+// Collapses every translation or rotation track whose keys all lie within tolerance of its first key, per component, into that single key. Rotations are
+// compared on the first key's hemisphere. The folded tracks drop out of per-frame sampling.
+TrackFoldStats FoldConstantTracks(AnimationTracks &tracks, float tolerance);
+
+// Samples tracks while remembering the key every track was on. Forward playback only steps over the keys that passed since the last call,
+// seeks and loop wraps fall back to a binary search.
+struct TrackSampler
+{
+    static constexpr uint32_t MAX_LINEAR_STEPS = 8;
+
+    std::vector<uint32_t> translationCursors;
+    std::vector<uint32_t> rotationCursors;
+    // Animated tracks this sampler updates
+    std::vector<uint32_t> translationTracks;
+    std::vector<uint32_t> rotationTracks;
+    float lastTime = 0.0f;
+
+    void Reset(const AnimationTracks &tracks);
+    // Only samples the animated tracks listed in boundTracks, negative entries are ignored. Lets a pose that skips bones skip their tracks too.
+    void Reset(const AnimationTracks &tracks, const int32_t *boundTracks, size_t boundCount);
+    void Sample(const AnimationTracks &tracks, float time, glm::vec3 *outTranslations, glm::quat *outRotations);
+};
+
+// Copies the keyframes hydra decodes for animation into tracks, one track per animated bone in the order of animation.GetBonesCRC64()
+void BuildTracks(TTH::Animation &animation, AnimationTracks &tracks);
+
+glm::quat Nlerp(const glm::quat &a, const glm::quat &b, float t);
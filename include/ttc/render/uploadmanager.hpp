@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <ttc/render/deviceallocator.hpp>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+// Identifies a batch of uploads, later batches get larger tickets. Ticket 0 counts as complete from the start.
+using UploadTicket = uint64_t;
+
+// Persistently mapped staging ring in front of the transfer queue. Uploads are written into the ring and queued as copy regions, Submit records every
+// queued region into one command buffer guarded by a fence and returns a ticket for it. Ring space is reused once the fence of the batch that used it
+// has signaled, so loading never waits for the whole queue to go idle.
+struct UploadManager
+{
+    struct Copy
+    {
+        VkBuffer dst;
+        VkBufferCopy region;
+    };
+    struct Batch
+    {
+        VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+        VkFence fence = VK_NULL_HANDLE;
+        UploadTicket ticket = 0;
+        // Ring position the batch's staging data ends at
+        VkDeviceSize end = 0;
+    };
+
+    VkBuffer buffer = VK_NULL_HANDLE;
+    MemoryAllocation allocation;
+    uint8_t *mapped = nullptr;
+    VkDeviceSize capacity = 0;
+    bool coherent = true;
+    VkDeviceSize nonCoherentAtomSize = 1;
+    VkQueue queue = VK_NULL_HANDLE;
+    VkCommandPool commandPool = VK_NULL_HANDLE;
+
+    // Ring positions only grow, position % capacity is the byte offset in buffer. [tail, batchBegin) belongs to batches in flight and
+    // [batchBegin, head) to the queued copies.
+    VkDeviceSize head = 0;
+    VkDeviceSize tail = 0;
+    VkDeviceSize batchBegin = 0;
+    std::vector<Copy> copies;
+    std::deque<Batch> inFlight;
+    // Retired batches whose command buffer and fence get reused
+    std::vector<Batch> idle;
+    UploadTicket submitted = 0;
+    UploadTicket completed = 0;
+
+    // Totals since Init, stalls count the times Stage had to wait for a batch to free ring space
+    uint64_t uploadedBytes = 0;
+    uint64_t batchCount = 0;
+    uint64_t stallCount = 0;
+
+    // commandPool has to belong to queue's family and allow resetting single command buffers
+    VkResult Init(VkDevice device, DeviceAllocator &allocator, VkQueue queue, VkCommandPool commandPool, VkDeviceSize capacity);
+    // Waits for every batch still in flight
+    void Destroy(VkDevice device, DeviceAllocator &allocator);
+
+    // Reserves size bytes of the ring that the next Submit copies to dst at dstOffset and returns where to write them. Submits the queued copies and
+    // waits for the oldest batches when the ring is full. size may not exceed capacity.
+    VkResult Stage(VkDevice device, VkBuffer dst, VkDeviceSize dstOffset, VkDeviceSize size, void *&out);
+    // Copies data to dst at dstOffset, split into ring sized pieces when it does not fit at once
+    VkResult Upload(VkDevice device, VkBuffer dst, VkDeviceSize dstOffset, const void *data, VkDeviceSize size);
+    // Sends every queued copy in a single submission. ticket completes with them and with every earlier upload.
+    VkResult Submit(VkDevice device, UploadTicket &ticket);
+    // Retires finished batches without blocking
+    bool IsComplete(VkDevice device, UploadTicket ticket);
+    VkResult Wait(VkDevice device, UploadTicket ticket);
+    // Frees the ring space of the oldest batch in flight, VK_NOT_READY when it has not finished and wait is false
+    VkResult RetireOldest(VkDevice device, bool wait);
+};
@@ -3,6 +3,9 @@
 #include <SDL3/SDL.h>
 #include <SDL3/SDL_vulkan.h>
 #include <array>
+#include <ttc/render/cspk2.hpp>
+#include <ttc/render/pose.hpp>
+#include <ttc/render/tracks.hpp>
 #include <tth/animation/animation.hpp>
 #include <tth/d3dmesh/d3dmesh.hpp>
 #include <tth/skeleton/skeleton.hpp>
@@ -26,6 +29,19 @@ struct Renderer
     TTH::Skeleton skeleton;
     TTH::Animation animation;
 
+    // Clips that would expand past MAX_EXPANDED_CLIP_SIZE are decoded from the bitstream while playing instead of up front
+    static constexpr size_t MAX_EXPANDED_CLIP_SIZE = 16 * 1024 * 1024;
+    // Streamed clips keep a decoder checkpoint every SEEK_KEY_INTERVAL keys or SEEK_TIME_INTERVAL seconds
+    static constexpr uint32_t SEEK_KEY_INTERVAL = 4096;
+    static constexpr float SEEK_TIME_INTERVAL = 0.25f;
+    bool streamAnimation = false;
+    CSPK2Stream animationStream;
+    CSPK2SeekIndex animationSeekIndex;
+    AnimationTracks animationTracks;
+    BoneBinding boneBinding;
+    std::vector<glm::vec3> sampledTranslations;
+    std::vector<glm::quat> sampledRotations;
+
     SDL_Window *window = nullptr;
 
     VkInstance instance = VK_NULL_HANDLE;
@@ -3,6 +3,19 @@
 #include <SDL3/SDL.h>
 #include <SDL3/SDL_vulkan.h>
 #include <array>
+#include <ttc/core/job.hpp>
+#include <ttc/render/bake.hpp>
+#include <ttc/render/character.hpp>
+#include <ttc/render/cspk2.hpp>
+#include <ttc/render/deviceallocator.hpp>
+#include <ttc/render/framering.hpp>
+#include <ttc/render/geometryarena.hpp>
+#include <ttc/render/pose.hpp>
+#include <ttc/render/posekernel.hpp>
+#include <ttc/render/posestage.hpp>
+#include <ttc/render/skinpalette.hpp>
+#include <ttc/render/uploadmanager.hpp>
+#include <ttc/render/tracks.hpp>
 #include <tth/animation/animation.hpp>
 #include <tth/d3dmesh/d3dmesh.hpp>
 #include <tth/skeleton/skeleton.hpp>
@@ -16,39 +29,111 @@ struct QueueFamilyIndices
     int64_t transferFamily;
 };
 
+// One draw of an arena mesh. Everything but the mesh goes to the draw data buffer the vertex shader indexes with the draw's instance.
+struct MeshDraw
+{
+    uint32_t mesh = 0; // Index into geometryArena.meshes
+    // Dequantization of the part's positions
+    glm::vec4 positionOffset{0.0f};
+    glm::vec4 positionScale{1.0f};
+    // Translation applied after skinning, only set for the copies of the benchmark scene
+    glm::vec4 instanceOffset{0.0f};
+};
+
 struct Renderer
 {
     static constexpr uint32_t MAX_FRAMES_IN_FLIGHT = 2;
+    // One row-major 3x4 affine matrix per bone
+    static constexpr VkDeviceSize BONE_PALETTE_ENTRY_SIZE = 12 * sizeof(float);
 
     float time = 0.0f;
 
-    TTH::D3DMesh d3dmesh;
+    // Optional, per-frame work fans out across its workers when set
+    JobSystem *jobSystem = nullptr;
+    // Draws are recorded into this many secondary command buffers in parallel when above one and jobSystem is set, read once in VulkanInit
+    uint32_t recordThreadCount = 1;
+    // Benchmark scene: the character is drawn this many extra times on a grid, all copies share its pose
+    uint32_t benchmarkCopies = 0;
+
+    // Parts of the character, all skinned against skeleton
+    std::vector<TTH::D3DMesh> d3dmeshes;
     TTH::Skeleton skeleton;
     TTH::Animation animation;
 
-    TTH::KeyframedValue<TTH::Quaternion> *animationRotations;
-    TTH::KeyframedValue<TTH::Vector3> *animationTranslations;
+    // Tracks whose keys all stay within this of their first key are folded into one value and no longer sampled, negative keeps every track
+    float constantTrackTolerance = 1e-4f;
+    // Resample the clip at bakeRate frames per second when above zero
+    float bakeRate = 0.0f;
+    BakeFormat bakeFormat = BakeFormat::UNORM16;
+    BakedClip bakedClip;
+    // Instead of resampling the clip, evaluate the pose of every frame at bakeRate up front and play back a blend of the two frames around the clip time
+    bool bakePoses = false;
+    BakedPoses bakedPoses;
+    // Clips that would expand past MAX_EXPANDED_CLIP_SIZE are decoded from the bitstream while playing instead of up front. animationTracks then
+    // only describes the stream's bones, folding and baking are skipped.
+    static constexpr size_t MAX_EXPANDED_CLIP_SIZE = 16 * 1024 * 1024;
+    // Streamed clips keep a decoder checkpoint every SEEK_KEY_INTERVAL keys or SEEK_TIME_INTERVAL seconds, so looping back costs one interval of decoding
+    static constexpr uint32_t SEEK_KEY_INTERVAL = 4096;
+    static constexpr float SEEK_TIME_INTERVAL = 0.25f;
+    bool streamAnimation = false;
+    CSPK2Stream animationStream;
+    CSPK2SeekIndex animationSeekIndex;
+    AnimationTracks animationTracks;
+    Character character;
+    PoseStage poseStage;
+    GeometryArena geometryArena;
+    std::vector<MeshDraw> meshDraws;
+    SkinPalette skinPalette;
 
     SDL_Window *window = nullptr;
 
-    VkDeviceMemory hostMemory = VK_NULL_HANDLE;   // Memory that can be mapped
-    VkDeviceMemory deviceMemory = VK_NULL_HANDLE; // Memory that cannot be mapped
-    VkBuffer stagingBuffer = VK_NULL_HANDLE;
-    void *stagingBufferMemory = VK_NULL_HANDLE;
+    // Every buffer and image below is sub-allocated from here
+    DeviceAllocator allocator;
+    // Everything that goes into device memory is staged through here on the transfer queue
+    UploadManager uploadManager;
+    VkDeviceSize uploadRingSize = 16 << 20;
+    // Covers the geometry, indirect and draw data uploads, the first submit that draws with them waits for it
+    UploadTicket geometryUpload = 0;
 
     // Should be allocated from device memory. That means I can't access these from CPU and I need to transfer data to it using vkCmdCopyBuffer and
     // submitting the command buffer to a queue with VK_QUEUE_TRANSFER_BIsT.
     VkBuffer vertexBuffer = VK_NULL_HANDLE;  // VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT
     VkBuffer indexBuffer = VK_NULL_HANDLE;   // VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT
-    VkBuffer uniformBuffer = VK_NULL_HANDLE; // VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT
+    // One VkDrawIndexedIndirectCommand and one draw data entry per meshDraws entry
+    VkBuffer indirectBuffer = VK_NULL_HANDLE; // VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT
+    VkBuffer drawDataBuffer = VK_NULL_HANDLE; // VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+    VkDeviceSize drawDataSize = 0;
+    MemoryAllocation indexMemory;
+    MemoryAllocation vertexMemory;
+    MemoryAllocation indirectMemory;
+    MemoryAllocation drawDataMemory;
+    // Whether the device takes many draws per vkCmdDrawIndexedIndirect with a non-zero firstInstance, otherwise every draw is issued on its own
+    bool multiDrawIndirect = false;
+    uint32_t maxDrawIndirectCount = 1;
+
+    // Uniform block and bone palette of every frame, written in place through a persistent mapping
+    FrameRing frameRing;
+    VkDeviceSize uniformAlignment = 0;
+    VkDeviceSize storageAlignment = 0;
+    VkDeviceSize bonePaletteSize = 0;
+    // Dynamic offsets of the current frame's allocations in frameRing
+    uint32_t uniformOffset = 0;
+    uint32_t bonePaletteOffset = 0;
 
     VkSemaphore uniformBufferSemaphore = VK_NULL_HANDLE;
 
     VkInstance instance = VK_NULL_HANDLE;
     VkDevice device = VK_NULL_HANDLE;
     VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
-    std::array<VkCommandBuffer, MAX_FRAMES_IN_FLIGHT> commandBuffers;
-    std::array<VkCommandBuffer, MAX_FRAMES_IN_FLIGHT> uniformCommandBuffers;
+    // Draws recorded once per swapchain image and frame slot, at [imageIndex * MAX_FRAMES_IN_FLIGHT + frame]. Only re-recorded after
+    // InvalidateCommandBuffers.
+    std::vector<VkCommandBuffer> commandBuffers;
+    std::vector<bool> commandBuffersRecorded;
+    // Effective record thread count. Thread t records with recordPools[t * MAX_FRAMES_IN_FLIGHT + frame] into
+    // secondaryCommandBuffers[(imageIndex * MAX_FRAMES_IN_FLIGHT + frame) * recordThreads + t].
+    uint32_t recordThreads = 1;
+    std::vector<VkCommandPool> recordPools;
+    std::vector<VkCommandBuffer> secondaryCommandBuffers;
     VkCommandPool commandPool = VK_NULL_HANDLE;
     VkCommandPool transferPool = VK_NULL_HANDLE;
     VkRenderPass renderPass = VK_NULL_HANDLE;
@@ -66,7 +151,6 @@ struct Renderer
     VkSwapchainKHR swapchain = VK_NULL_HANDLE;
     VkSurfaceKHR surface = VK_NULL_HANDLE;
 
-    std::array<VkSemaphore, MAX_FRAMES_IN_FLIGHT> uniformBufferReadySemaphores;
     std::array<VkSemaphore, MAX_FRAMES_IN_FLIGHT> imageAvailableSemaphores;
     std::array<VkSemaphore, MAX_FRAMES_IN_FLIGHT> renderFinishedSemaphores;
     std::array<VkFence, MAX_FRAMES_IN_FLIGHT> inFlightFences;
@@ -78,14 +162,16 @@ struct Renderer
     VkFramebuffer *swapchainFramebuffers = nullptr;
 
     VkDescriptorPool descriptorPool;
-    std::array<VkDescriptorSet, MAX_FRAMES_IN_FLIGHT> descriptorSets;
+    VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
 
-    VkDeviceMemory depthImageMemory = VK_NULL_HANDLE;
+    MemoryAllocation depthImageMemory;
     VkImage depthImage = VK_NULL_HANDLE;
     VkImageView depthImageView = VK_NULL_HANDLE;
 
     VkResult DrawFrame();
     VkResult RecordCommandBuffer(uint32_t imageIndex);
+    VkResult RecordSecondaryCommandBuffer(uint32_t imageIndex, uint32_t thread);
+    void RecordDraws(VkCommandBuffer commandBuffer, size_t first, size_t last);
     VkResult VulkanInit();
     VkResult PickPhysicalDevice();
     VkResult CreateLogicalDevice(const QueueFamilyIndices &indices);
@@ -102,6 +188,9 @@ struct Renderer
     VkResult UpdateUniformBuffer();
     VkResult CopyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size);
     VkResult RecreateSwapchain();
+    VkResult AllocateCommandBuffers();
+    // Has to be called after any change to what the draws record: meshes, buffers, pipeline, descriptor sets or the swapchain
+    void InvalidateCommandBuffers();
     VkResult CreateDescriptorSetLayout();
     VkResult CreateDescriptorPool();
     VkResult CreateDescriptorSets();
@@ -111,8 +200,8 @@ struct Renderer
     VkResult InitializeBuffers();
     VkFormat FindSupportedFormat(const std::vector<VkFormat> &candidates, VkImageTiling tiling, VkFormatFeatureFlags features);
     VkFormat FindDepthFormat();
-    VkResult CreateImage(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage &image,
-                         VkDeviceMemory &imageMemory);
+    VkResult CreateImage(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, MemoryCategory category,
+                         VkImage &image, MemoryAllocation &imageMemory);
     int64_t FindMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags flags);
     void CleanupSwapchain();
     ~Renderer();
@@ -1,17 +1,35 @@
 #version 450
 
 layout(binding = 0) uniform UniformBufferObject {
-    mat4 baseTransforms[256];
-    mat4 boneTransforms[256];
     mat4 model;
     mat4 view;
     mat4 proj;
-    mat4 vertexTransform;
-    int boneCount;
 } ubo;
 
+// Pushed once per vkCmdDrawIndexedIndirect
+layout(push_constant) uniform DrawPushConstants {
+    uint boneCount;
+    uint drawBase; // Added to the instance index, only non-zero when every draw is issued on its own
+} draw;
+
+// Skinning matrices (global * inverse bind) of every bone, each stored as the three rows of a 3x4 affine matrix
+layout(std430, binding = 1) readonly buffer BonePalette {
+    vec4 boneRows[];
+};
+
+struct DrawData {
+    vec4 positionOffset; // Dequantizes the part's positions
+    vec4 positionScale;
+    vec4 instanceOffset; // Added after skinning
+};
+
+// One entry per draw, selected by the draw's firstInstance
+layout(std430, binding = 2) readonly buffer DrawDataBuffer {
+    DrawData drawData[];
+};
+
 layout(location = 0) in vec4 inPosition;
-layout(location = 1) in float blendWeight;
+layout(location = 1) in vec4 blendWeight; // UN10x3_UN2, bound as A2R10G10B10_UNORM so x holds bits 20..29 and z bits 0..9
 layout(location = 2) in uvec4 blendIndex;
 layout(location = 3) in vec4 normals;
 layout(location = 4) in vec4 tangents;
@@ -21,42 +39,39 @@ layout(location = 7) in vec2 texCoords2;
 
 layout(location = 0) out vec3 fragColor;
 
+// Three weights are packed at reduced range, the first influence gets whatever is left of 1
+vec4 UnpackBlendWeights(vec4 packed) {
+    vec4 weights;
+    weights.y = packed.z / 8.0 + packed.w * 3.0 / 8.0;
+    weights.z = packed.y / 3.0;
+    weights.w = packed.x / 4.0;
+    weights.x = 1.0 - weights.y - weights.z - weights.w;
+    return weights;
+}
+
 void main() {
-    /*
-    vec4 animatedPosition = vec4(0.0);
-    mat4 jointTransform = mat4(0.0);
-    vec4 inWeight = vec4(1.0, 0.0, 0.0, 0.0);
-    for(int i = 0; i < 4; i++) {
-        if(inWeight[i] == 0) {
+    DrawData data = drawData[draw.drawBase + uint(gl_InstanceIndex)];
+    vec4 weights = UnpackBlendWeights(blendWeight);
+    vec4 row0 = vec4(0.0);
+    vec4 row1 = vec4(0.0);
+    vec4 row2 = vec4(0.0);
+    float totalWeight = 0.0;
+    for (int i = 0; i < 4; i++) {
+        if (weights[i] <= 0.0 || blendIndex[i] >= draw.boneCount) {
             continue;
         }
-        if(blendIndex[i] >= ubo.boneCount) {
-            animatedPosition = inPosition;
-            jointTransform = mat4(1.0);
-            break;
-        }
-
-        mat4 jointMatrix = ubo.boneTransforms[blendIndex[i]];
+        uint bone = blendIndex[i] * 3u;
+        row0 += boneRows[bone] * weights[i];
+        row1 += boneRows[bone + 1u] * weights[i];
+        row2 += boneRows[bone + 2u] * weights[i];
+        totalWeight += weights[i];
+    }
 
-        vec4 localPosition = jointMatrix * inPosition;
-        animatedPosition += localPosition * inWeight[i];
-        jointTransform += jointMatrix * inWeight[i];
+    vec4 bindPosition = vec4(inPosition.xyz * data.positionScale.xyz + data.positionOffset.xyz, 1.0);
+    vec4 skinnedPosition = bindPosition;
+    if (totalWeight > 0.0) {
+        skinnedPosition = vec4(dot(row0, bindPosition), dot(row1, bindPosition), dot(row2, bindPosition), 1.0);
     }
-    vec4 positionWorld = ubo.model * animatedPosition;
-
-    vec4 newVertex;
-    newVertex = ((inverse(ubo.baseTransforms[blendIndex.x]) * ubo.baseTransforms[blendIndex.x]) * inPosition) * inWeight.x;
-    newVertex = ((inverse(ubo.baseTransforms[blendIndex.y]) * ubo.baseTransforms[blendIndex.y]) * inPosition) * inWeight.y + newVertex;
-    newVertex = ((inverse(ubo.baseTransforms[blendIndex.z]) * ubo.baseTransforms[blendIndex.z]) * inPosition) * inWeight.z + newVertex;
-    newVertex = ((inverse(ubo.baseTransforms[blendIndex.w]) * ubo.baseTransforms[blendIndex.w]) * inPosition) * inWeight.w + newVertex;
-    */
-
-    //newVertex = vec4(inPosition, 1.0) * inWeight.x;
-    //newVertex = vec4(inPosition, 1.0) * inWeight.y + newVertex;
-    //newVertex = vec4(inPosition, 1.0) * inWeight.z + newVertex;
-    //newVertex = vec4(inPosition, 1.0) * inWeight.w + newVertex;
-
-    gl_Position = ubo.proj * ubo.view * ubo.model * ubo.vertexTransform * vec4(inPosition.xyz, 1.0);
-    //gl_Position = vec4(inPosition.xyz, 1.0);
+    gl_Position = ubo.proj * ubo.view * ubo.model * (skinnedPosition + vec4(data.instanceOffset.xyz, 0.0));
     fragColor = vec3(0.82, 0.06, 0.06);
 }
\ No newline at end of file
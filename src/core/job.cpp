@@ -0,0 +1,207 @@
+#include <ttc/core/job.hpp>
+
+// Queue of the current thread within the job system it belongs to, foreign threads use the queue of the thread that called Init
+static thread_local const JobSystem *currentSystem = nullptr;
+static thread_local uint32_t currentQueue = 0;
+
+void JobSystem::Init(uint32_t workerCount)
+{
+    Shutdown();
+    if (workerCount == 0)
+    {
+        uint32_t hardwareThreads = std::thread::hardware_concurrency();
+        workerCount = hardwareThreads > 1 ? hardwareThreads - 1 : 0;
+    }
+
+    queues.resize(workerCount + 1);
+    for (std::unique_ptr<Queue> &queue : queues)
+    {
+        queue = std::make_unique<Queue>();
+    }
+    currentSystem = this;
+    currentQueue = 0;
+
+    running.store(true, std::memory_order_release);
+    threads.reserve(workerCount);
+    for (uint32_t i = 1; i <= workerCount; ++i)
+    {
+        threads.emplace_back(&JobSystem::WorkerMain, this, i);
+    }
+}
+
+void JobSystem::Shutdown()
+{
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        running.store(false, std::memory_order_release);
+    }
+    wake.notify_all();
+    for (std::thread &thread : threads)
+    {
+        thread.join();
+    }
+    threads.clear();
+
+    // Whatever is still queued runs on the calling thread so no counter is left pending
+    for (uint32_t i = 0; i < queues.size(); ++i)
+    {
+        while (TryRunOne(i))
+        {
+        }
+    }
+    queues.clear();
+    if (currentSystem == this)
+    {
+        currentSystem = nullptr;
+    }
+}
+
+uint32_t JobSystem::GetQueueIndex() const
+{
+    return currentSystem == this ? currentQueue : 0;
+}
+
+void JobSystem::Push(const Job &job)
+{
+    Queue &queue = *queues[GetQueueIndex()];
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.jobs.push_back(job);
+    }
+    queuedJobs.fetch_add(1, std::memory_order_release);
+    {
+        // Taking the lock orders the push against a worker that is about to sleep
+        std::lock_guard<std::mutex> lock(sleepMutex);
+    }
+    wake.notify_one();
+}
+
+void JobSystem::Run(const Job *jobs, uint32_t count, JobCounter *counter, JobCounter *dependency)
+{
+    if (counter != nullptr)
+    {
+        counter->pending.fetch_add(count, std::memory_order_acq_rel);
+    }
+
+    if (dependency != nullptr)
+    {
+        std::lock_guard<std::mutex> lock(dependency->mutex);
+        if (!dependency->IsDone())
+        {
+            for (uint32_t i = 0; i < count; ++i)
+            {
+                dependency->continuations.push_back(jobs[i]);
+                dependency->continuations.back().counter = counter;
+            }
+            return;
+        }
+    }
+
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        Job job = jobs[i];
+        job.counter = counter;
+        if (queues.empty())
+        {
+            Execute(job);
+        }
+        else
+        {
+            Push(job);
+        }
+    }
+}
+
+void JobSystem::Wait(JobCounter *counter)
+{
+    uint32_t queueIndex = GetQueueIndex();
+    while (!counter->IsDone())
+    {
+        if (queues.empty() || !TryRunOne(queueIndex))
+        {
+            std::this_thread::yield();
+        }
+    }
+    // The job that finished the counter may still hold its lock
+    std::lock_guard<std::mutex> lock(counter->mutex);
+}
+
+bool JobSystem::TryRunOne(uint32_t queueIndex)
+{
+    Job job;
+    bool found = false;
+    {
+        Queue &queue = *queues[queueIndex];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.jobs.empty())
+        {
+            job = queue.jobs.back();
+            queue.jobs.pop_back();
+            found = true;
+        }
+    }
+    for (uint32_t i = 1; i < queues.size() && !found; ++i)
+    {
+        Queue &victim = *queues[(queueIndex + i) % queues.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.jobs.empty())
+        {
+            job = victim.jobs.front();
+            victim.jobs.pop_front();
+            found = true;
+        }
+    }
+    if (!found)
+    {
+        return false;
+    }
+
+    queuedJobs.fetch_sub(1, std::memory_order_acq_rel);
+    Execute(job);
+    return true;
+}
+
+void JobSystem::Execute(const Job &job)
+{
+    job.function(job.userData, job.index);
+    if (job.counter == nullptr)
+    {
+        return;
+    }
+
+    // Decrementing under the lock keeps parking in Run from racing the release of the continuations
+    std::vector<Job> continuations;
+    {
+        std::lock_guard<std::mutex> lock(job.counter->mutex);
+        if (job.counter->pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            continuations.swap(job.counter->continuations);
+        }
+    }
+    for (const Job &continuation : continuations)
+    {
+        if (queues.empty())
+        {
+            Execute(continuation);
+        }
+        else
+        {
+            Push(continuation);
+        }
+    }
+}
+
+void JobSystem::WorkerMain(uint32_t queueIndex)
+{
+    currentSystem = this;
+    currentQueue = queueIndex;
+    while (running.load(std::memory_order_acquire))
+    {
+        if (TryRunOne(queueIndex))
+        {
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        wake.wait(lock, [this] { return queuedJobs.load(std::memory_order_acquire) > 0 || !running.load(std::memory_order_acquire); });
+    }
+}
@@ -1,6 +1,9 @@
 #include <cerrno>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <ttc/core/gui.hpp>
+#include <ttc/core/job.hpp>
 #include <ttc/render/vulkan3.hpp>
 #include <tth/animation/animation.hpp>
 #include <tth/convert/asset.hpp>
@@ -14,13 +17,63 @@ using namespace TTH;
 int main(void)
 {
 
+    JobSystem jobSystem;
+    jobSystem.Init();
+
     Renderer renderer;
-    renderer.d3dmesh.Create();
+    renderer.jobSystem = &jobSystem;
+    renderer.recordThreadCount = jobSystem.GetThreadCount();
+    // CHIMERA_BENCHMARK=<copies> draws the character that many extra times to stress command recording
+    if (const char *benchmarkCopies = std::getenv("CHIMERA_BENCHMARK"))
+    {
+        renderer.benchmarkCopies = static_cast<uint32_t>(std::strtoul(benchmarkCopies, nullptr, 10));
+    }
+    // CHIMERA_BAKE_RATE=<frames per second>[,unorm8|unorm16|float32] resamples the clip at a fixed rate up front, with 16 bits per component by default
+    if (const char *bakeRate = std::getenv("CHIMERA_BAKE_RATE"))
+    {
+        char *format = nullptr;
+        renderer.bakeRate = std::strtof(bakeRate, &format);
+        if (*format == ',')
+        {
+            ++format;
+        }
+        if (strcmp(format, "unorm8") == 0)
+        {
+            renderer.bakeFormat = BakeFormat::UNORM8;
+        }
+        else if (strcmp(format, "float32") == 0)
+        {
+            renderer.bakeFormat = BakeFormat::FLOAT32;
+        }
+        else if (*format != '\0' && strcmp(format, "unorm16") != 0)
+        {
+            TTH_LOG_ERROR("Unknown bake format %s, using unorm16\n", format);
+        }
+    }
+    // CHIMERA_BAKE_POSES=<frames per second> evaluates every frame's pose up front in one sweep and plays those back, the frames an export sees
+    if (const char *bakeRate = std::getenv("CHIMERA_BAKE_POSES"))
+    {
+        renderer.bakeRate = std::strtof(bakeRate, nullptr);
+        renderer.bakePoses = true;
+    }
     renderer.animation.Create();
     renderer.skeleton.Create();
 
-    Stream streamMesh = Stream("/home/asil/Documents/decryption/TelltaleDevTool/cipherTexts/d3dmesh/sk61_javier_bodyUpper.d3dmesh", "rb");
-    streamMesh.SeekMetaHeaderEnd();
+    // Every part is skinned against sk61_javier.skl and shares one pose
+    const char *meshPaths[] = {
+        "/home/asil/Documents/decryption/TelltaleDevTool/cipherTexts/d3dmesh/sk61_javier_bodyUpper.d3dmesh",
+        "/home/asil/Documents/decryption/TelltaleDevTool/cipherTexts/d3dmesh/sk61_javier_bodyLower.d3dmesh",
+        "/home/asil/Documents/decryption/TelltaleDevTool/cipherTexts/d3dmesh/sk61_javier_head.d3dmesh",
+        "/home/asil/Documents/decryption/TelltaleDevTool/cipherTexts/d3dmesh/sk61_javier_eyesMouth.d3dmesh",
+    };
+    renderer.d3dmeshes.resize(sizeof(meshPaths) / sizeof(meshPaths[0]));
+    for (size_t i = 0; i < renderer.d3dmeshes.size(); ++i)
+    {
+        renderer.d3dmeshes[i].Create();
+        Stream streamMesh = Stream(meshPaths[i], "rb");
+        streamMesh.SeekMetaHeaderEnd();
+        streamMesh.Read(renderer.d3dmeshes[i], false);
+    }
 
     Stream streamAnimation = Stream("/home/asil/Documents/decryption/TelltaleDevTool/cipherTexts/animation/sk61_javierAction_toStandA.anm", "rb");
     streamAnimation.SeekMetaHeaderEnd();
@@ -28,7 +81,6 @@ int main(void)
     Stream streamSkeleton = Stream("/home/asil/Documents/decryption/TelltaleDevTool/cipherTexts/skl/sk61_javier.skl", "rb");
     streamSkeleton.SeekMetaHeaderEnd();
 
-    streamMesh.Read(renderer.d3dmesh, false);
     streamAnimation.Read(renderer.animation, false);
     streamSkeleton.Read(renderer.skeleton, false);
 
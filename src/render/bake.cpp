@@ -0,0 +1,271 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <ttc/render/bake.hpp>
+
+static float GetMaxValue(BakeFormat format)
+{
+    return format == BakeFormat::UNORM8 ? 255.0f : 65535.0f;
+}
+
+static void StoreComponent(uint8_t *out, BakeFormat format, float value, float min, float scale)
+{
+    switch (format)
+    {
+    case BakeFormat::UNORM8:
+        *out = (uint8_t)std::clamp(std::lround((value - min) / scale), 0l, 255l);
+        break;
+    case BakeFormat::UNORM16:
+    {
+        uint16_t quantized = (uint16_t)std::clamp(std::lround((value - min) / scale), 0l, 65535l);
+        memcpy(out, &quantized, sizeof(quantized));
+        break;
+    }
+    case BakeFormat::FLOAT32:
+        memcpy(out, &value, sizeof(value));
+        break;
+    }
+}
+
+static float LoadComponent(const uint8_t *in, BakeFormat format, float min, float scale)
+{
+    switch (format)
+    {
+    case BakeFormat::UNORM8:
+        return (float)*in * scale + min;
+    case BakeFormat::UNORM16:
+    {
+        uint16_t quantized;
+        memcpy(&quantized, in, sizeof(quantized));
+        return (float)quantized * scale + min;
+    }
+    case BakeFormat::FLOAT32:
+    {
+        float value;
+        memcpy(&value, in, sizeof(value));
+        return value;
+    }
+    }
+    return 0.0f;
+}
+
+size_t BakedClip::GetMemoryUsage() const
+{
+    return frames.size() + boneCRC64.size() * sizeof(uint64_t) + (translationTracks.size() + rotationTracks.size()) * sizeof(uint32_t) +
+           (translationMin.size() + translationScale.size()) * sizeof(glm::vec3);
+}
+
+void BakedClip::Clear()
+{
+    duration = 0.0f;
+    frameRate = 0.0f;
+    frameCount = 0;
+    boneCRC64.clear();
+    translationTracks.clear();
+    rotationTracks.clear();
+    translationMin.clear();
+    translationScale.clear();
+    frameStride = 0;
+    frames.clear();
+}
+
+void BakedClip::Sample(float time, glm::vec3 *outTranslations, glm::quat *outRotations) const
+{
+    if (frameCount == 0)
+    {
+        return;
+    }
+
+    float frame = std::clamp(time * frameRate, 0.0f, (float)(frameCount - 1));
+    uint32_t first = std::min((uint32_t)frame, frameCount - 1);
+    uint32_t second = std::min(first + 1, frameCount - 1);
+    // The last interval ends at the clip's end and can be shorter than a frame, so the weight comes from the real frame times
+    float firstTime = GetFrameTime(first);
+    float secondTime = GetFrameTime(second);
+    float t = secondTime > firstTime ? std::clamp((time - firstTime) / (secondTime - firstTime), 0.0f, 1.0f) : 0.0f;
+
+    size_t componentSize = (size_t)format;
+    float rotationScale = format == BakeFormat::FLOAT32 ? 1.0f : 2.0f / GetMaxValue(format);
+    const uint8_t *a = frames.data() + first * frameStride;
+    const uint8_t *b = frames.data() + second * frameStride;
+    for (size_t i = 0; i < translationTracks.size(); ++i)
+    {
+        glm::vec3 va, vb;
+        for (int c = 0; c < 3; ++c)
+        {
+            va[c] = LoadComponent(a + c * componentSize, format, translationMin[i][c], translationScale[i][c]);
+            vb[c] = LoadComponent(b + c * componentSize, format, translationMin[i][c], translationScale[i][c]);
+        }
+        outTranslations[translationTracks[i]] = glm::mix(va, vb, t);
+        a += 3 * componentSize;
+        b += 3 * componentSize;
+    }
+    for (size_t i = 0; i < rotationTracks.size(); ++i)
+    {
+        glm::quat qa, qb;
+        for (int c = 0; c < 4; ++c)
+        {
+            qa[c] = LoadComponent(a + c * componentSize, format, -1.0f, rotationScale);
+            qb[c] = LoadComponent(b + c * componentSize, format, -1.0f, rotationScale);
+        }
+        outRotations[rotationTracks[i]] = Nlerp(qa, qb, t);
+        a += 4 * componentSize;
+        b += 4 * componentSize;
+    }
+}
+
+TTH::errno_t BakeTracks(const AnimationTracks &tracks, float frameRate, BakeFormat format, BakedClip &clip)
+{
+    clip.Clear();
+    if (frameRate <= 0.0f || tracks.duration < 0.0f)
+    {
+        return -EINVAL;
+    }
+
+    clip.duration = tracks.duration;
+    clip.frameRate = frameRate;
+    clip.frameCount = (uint32_t)std::ceil(tracks.duration * frameRate) + 1;
+    clip.format = format;
+    clip.boneCRC64 = tracks.boneCRC64;
+    // Constant tracks are left to the base values of tracks, the same way sampling the tracks directly leaves them
+    clip.translationTracks = tracks.animatedTranslationTracks;
+    clip.rotationTracks = tracks.animatedRotationTracks;
+
+    // Keys are lerped between, so the extremes of every translation track are its keys
+    float maxValue = GetMaxValue(format);
+    for (uint32_t track : clip.translationTracks)
+    {
+        glm::vec3 min(INFINITY), max(-INFINITY);
+        for (uint32_t i = tracks.translationOffsets[track]; i < tracks.translationOffsets[track + 1]; ++i)
+        {
+            min = glm::min(min, tracks.translations[i]);
+            max = glm::max(max, tracks.translations[i]);
+        }
+        glm::vec3 scale = format == BakeFormat::FLOAT32 ? glm::vec3(1.0f) : (max - min) / maxValue;
+        clip.translationMin.push_back(min);
+        clip.translationScale.push_back(glm::max(scale, glm::vec3(1e-30f)));
+    }
+
+    size_t componentSize = (size_t)format;
+    float rotationScale = format == BakeFormat::FLOAT32 ? 1.0f : 2.0f / maxValue;
+    clip.frameStride = (clip.translationTracks.size() * 3 + clip.rotationTracks.size() * 4) * componentSize;
+    clip.frames.resize(clip.frameCount * clip.frameStride);
+
+    TrackSampler sampler;
+    sampler.Reset(tracks);
+    std::vector<glm::vec3> translations = tracks.baseTranslations;
+    std::vector<glm::quat> rotations = tracks.baseRotations;
+    std::vector<glm::quat> previousRotations(clip.rotationTracks.size(), glm::quat(1.0f, 0.0f, 0.0f, 0.0f));
+    for (uint32_t frame = 0; frame < clip.frameCount; ++frame)
+    {
+        sampler.Sample(tracks, clip.GetFrameTime(frame), translations.data(), rotations.data());
+
+        uint8_t *out = clip.frames.data() + frame * clip.frameStride;
+        for (size_t i = 0; i < clip.translationTracks.size(); ++i)
+        {
+            const glm::vec3 &value = translations[clip.translationTracks[i]];
+            for (int c = 0; c < 3; ++c)
+            {
+                StoreComponent(out + c * componentSize, format, value[c], clip.translationMin[i][c], clip.translationScale[i][c]);
+            }
+            out += 3 * componentSize;
+        }
+        for (size_t i = 0; i < clip.rotationTracks.size(); ++i)
+        {
+            glm::quat value = glm::normalize(rotations[clip.rotationTracks[i]]);
+            if (frame > 0 && glm::dot(value, previousRotations[i]) < 0.0f)
+            {
+                value = -value;
+            }
+            previousRotations[i] = value;
+            for (int c = 0; c < 4; ++c)
+            {
+                StoreComponent(out + c * componentSize, format, value[c], -1.0f, rotationScale);
+            }
+            out += 4 * componentSize;
+        }
+    }
+    return 0;
+}
+
+void BakedPoses::Sample(float time, const SkeletonHierarchy &hierarchy, LocalPose &pose) const
+{
+    pose.Resize(hierarchy.GetBoneCount());
+    if (frameCount == 0)
+    {
+        return;
+    }
+
+    float frame = std::clamp(time * frameRate, 0.0f, (float)(frameCount - 1));
+    uint32_t first = std::min((uint32_t)frame, frameCount - 1);
+    uint32_t second = std::min(first + 1, frameCount - 1);
+    float firstTime = GetFrameTime(first);
+    float secondTime = GetFrameTime(second);
+    float t = secondTime > firstTime ? std::clamp((time - firstTime) / (secondTime - firstTime), 0.0f, 1.0f) : 0.0f;
+
+    // Locals are translate * rotate, so their parts blend like the ones of BakedClip::Sample
+    const glm::mat4 *a = GetLocalTransforms(first);
+    const glm::mat4 *b = GetLocalTransforms(second);
+    for (size_t i = 0; i < hierarchy.GetBoneCount(); ++i)
+    {
+        const glm::mat4 &la = a[hierarchy.skeletonIndices[i]];
+        const glm::mat4 &lb = b[hierarchy.skeletonIndices[i]];
+        pose.Set(i, glm::mix(glm::vec3(la[3]), glm::vec3(lb[3]), t), Nlerp(glm::quat_cast(la), glm::quat_cast(lb), t));
+    }
+}
+
+void BakedPoses::Clear()
+{
+    duration = 0.0f;
+    frameRate = 0.0f;
+    frameCount = 0;
+    boneCount = 0;
+    localTransforms.clear();
+    globalTransforms.clear();
+}
+
+TTH::errno_t BakePoses(const AnimationTracks &tracks, const SkeletonHierarchy &hierarchy, float frameRate, BakedPoses &poses)
+{
+    poses.Clear();
+    if (frameRate <= 0.0f || tracks.duration < 0.0f)
+    {
+        return -EINVAL;
+    }
+
+    poses.duration = tracks.duration;
+    poses.frameRate = frameRate;
+    poses.frameCount = (uint32_t)std::ceil(tracks.duration * frameRate) + 1;
+    // Bones hierarchy leaves out keep the identity
+    poses.boneCount = hierarchy.skeletonBoneCount;
+    poses.localTransforms.assign(poses.frameCount * poses.boneCount, glm::mat4(1.0f));
+    poses.globalTransforms.assign(poses.frameCount * poses.boneCount, glm::mat4(1.0f));
+
+    BoneBinding binding;
+    binding.Build(hierarchy.boneCRC64.data(), hierarchy.GetBoneCount(), tracks);
+    TrackSampler sampler;
+    sampler.Reset(tracks);
+    std::vector<glm::vec3> translations = tracks.baseTranslations;
+    std::vector<glm::quat> rotations = tracks.baseRotations;
+    LocalPose pose = hierarchy.restPose;
+    std::vector<glm::mat4> locals(hierarchy.GetBoneCount());
+    std::vector<glm::mat4> globals(hierarchy.GetBoneCount());
+    std::vector<glm::mat4> scratch(hierarchy.GetMaxLevelSize());
+    for (uint32_t frame = 0; frame < poses.frameCount; ++frame)
+    {
+        // Frame times only move forward, so the sampler steps over every key once across the whole bake
+        sampler.Sample(tracks, poses.GetFrameTime(frame), translations.data(), rotations.data());
+        ApplySampledPose(hierarchy, binding, tracks, translations.data(), rotations.data(), pose);
+        BuildLocalMatrices(pose, 0, hierarchy.GetBoneCount(), locals.data());
+        globals = locals;
+        hierarchy.ComposeGlobals(globals.data(), scratch.data());
+
+        glm::mat4 *outLocals = poses.localTransforms.data() + frame * poses.boneCount;
+        glm::mat4 *outGlobals = poses.globalTransforms.data() + frame * poses.boneCount;
+        for (size_t i = 0; i < hierarchy.GetBoneCount(); ++i)
+        {
+            outLocals[hierarchy.skeletonIndices[i]] = locals[i];
+            outGlobals[hierarchy.skeletonIndices[i]] = globals[i];
+        }
+    }
+    return 0;
+}
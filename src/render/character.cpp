@@ -0,0 +1,120 @@
+#include <cstring>
+#include <ttc/render/character.hpp>
+#include <ttc/render/posekernel.hpp>
+
+TTH::errno_t Character::Build(const TTH::Skeleton &skeleton, const AnimationTracks &tracks)
+{
+    TTH::errno_t err = hierarchy.Build(skeleton);
+    if (err < 0)
+    {
+        return err;
+    }
+    boneBinding.Build(hierarchy.boneCRC64.data(), hierarchy.GetBoneCount(), tracks);
+
+    std::vector<glm::mat4> composeScratch(hierarchy.GetMaxLevelSize());
+    std::vector<glm::mat4> restGlobals(hierarchy.GetBoneCount());
+    BuildLocalMatrices(hierarchy.restPose, 0, hierarchy.GetBoneCount(), restGlobals.data());
+    hierarchy.ComposeGlobals(restGlobals.data(), composeScratch.data());
+    inverseBindMatrices.resize(hierarchy.GetBoneCount());
+    for (size_t i = 0; i < hierarchy.GetBoneCount(); ++i)
+    {
+        inverseBindMatrices[hierarchy.skeletonIndices[i]] = glm::inverse(restGlobals[i]);
+    }
+    return 0;
+}
+
+template <typename T> static void MarkBoneIndices(const uint8_t *vertices, size_t vertexCount, size_t stride, uint32_t componentCount, std::vector<bool> &used)
+{
+    for (size_t i = 0; i < vertexCount; ++i, vertices += stride)
+    {
+        for (uint32_t c = 0; c < componentCount; ++c)
+        {
+            T index;
+            memcpy(&index, vertices + c * sizeof(T), sizeof(T));
+            if (index < used.size())
+            {
+                used[index] = true;
+            }
+        }
+    }
+}
+
+void Character::AddPart(const TTH::D3DMesh &mesh)
+{
+    parts.push_back(&mesh);
+    usedBones.resize(GetBoneCount(), false);
+    for (size_t i = 0; i < mesh.GetVertexBufferCount(); ++i)
+    {
+        TTH::D3DMesh::AttributeDescription attributes[32];
+        const uint8_t *vertices = static_cast<const uint8_t *>(mesh.GetVertexBuffer(i, 0, 0, attributes));
+        size_t attributeCount = mesh.GetVertexBufferAttributeCount(i);
+        if (vertices == nullptr || attributeCount == 0)
+        {
+            continue;
+        }
+        size_t stride = attributes[attributeCount - 1].offset + TTH::D3DMesh::GetFormatStride(attributes[attributeCount - 1].format);
+        for (size_t j = 0; j < attributeCount; ++j)
+        {
+            if (attributes[j].attribute != TTH::D3DMesh::GFXPlatformVertexAttribute::eGFXPlatformAttribute_BlendIndex)
+            {
+                continue;
+            }
+            // Indices with zero weight are marked too, the cost is a few extra bones at most
+            const uint8_t *first = vertices + attributes[j].offset;
+            switch (attributes[j].format)
+            {
+            case TTH::D3DMesh::GFXPlatformFormat::eGFXPlatformFormat_U8x4:
+                MarkBoneIndices<uint8_t>(first, mesh.GetVertexCount(), stride, 4, usedBones);
+                break;
+            case TTH::D3DMesh::GFXPlatformFormat::eGFXPlatformFormat_U8x2:
+                MarkBoneIndices<uint8_t>(first, mesh.GetVertexCount(), stride, 2, usedBones);
+                break;
+            case TTH::D3DMesh::GFXPlatformFormat::eGFXPlatformFormat_U16x4:
+                MarkBoneIndices<uint16_t>(first, mesh.GetVertexCount(), stride, 4, usedBones);
+                break;
+            case TTH::D3DMesh::GFXPlatformFormat::eGFXPlatformFormat_U16x2:
+                MarkBoneIndices<uint16_t>(first, mesh.GetVertexCount(), stride, 2, usedBones);
+                break;
+            case TTH::D3DMesh::GFXPlatformFormat::eGFXPlatformFormat_U32x4:
+                MarkBoneIndices<uint32_t>(first, mesh.GetVertexCount(), stride, 4, usedBones);
+                break;
+            default:
+                // Unknown index layout, keep every bone
+                usedBones.assign(GetBoneCount(), true);
+                break;
+            }
+        }
+    }
+}
+
+uint32_t Character::AddToStage(PoseStage &stage, const AnimationTracks &tracks)
+{
+    std::vector<bool> keep(GetBoneCount(), false);
+    bool anyUsed = false;
+    for (size_t i = 0; i < GetBoneCount(); ++i)
+    {
+        keep[i] = !usedBones.empty() && usedBones[hierarchy.skeletonIndices[i]];
+        anyUsed |= keep[i];
+    }
+    if (!anyUsed)
+    {
+        keep.assign(GetBoneCount(), true);
+    }
+    hierarchy.Subset(keep, evaluatedHierarchy);
+    evaluatedBinding.Build(evaluatedHierarchy.boneCRC64.data(), evaluatedHierarchy.GetBoneCount(), tracks);
+
+    poseInstance = stage.AddInstance(evaluatedHierarchy, tracks, evaluatedBinding);
+    return poseInstance;
+}
+
+void Character::Clear()
+{
+    hierarchy.Clear();
+    boneBinding.trackIndices.clear();
+    inverseBindMatrices.clear();
+    usedBones.clear();
+    evaluatedHierarchy.Clear();
+    evaluatedBinding.trackIndices.clear();
+    parts.clear();
+    poseInstance = 0;
+}
@@ -0,0 +1,510 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <ttc/render/cspk2.hpp>
+#include <tth/core/log.hpp>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define TTC_CSPK2_SSE 1
+#endif
+
+// Scale and offset of the x, y and z fields of one kind of block
+struct CSPK2Range
+{
+    float scale[3];
+    float offset[3];
+};
+
+static CSPK2Range MakeRange(const TTH::Vector3 &scale, const TTH::Vector3 &offset)
+{
+    return CSPK2Range{{scale.x, scale.y, scale.z}, {offset.x, offset.y, offset.z}};
+}
+
+static const CSPK2Range ABSOLUTE_QUATERNION_RANGE = {{1.3487e-06f, 3.371749e-07f, 3.371749e-07f}, {-0.7071068f, -0.7071068f, -0.7071068f}};
+
+// Unpacks a block of 4 samples into one row per sample. Every word holds 10/11/11-bit x/y/z fields, absolute blocks carry the high bits of every field in a
+// second group of 4 words. Quaternion blocks rebuild w from the unit length into the fourth column, vector blocks leave it at zero.
+#if TTC_CSPK2_SSE
+static void UnpackBlock(const uint32_t *words, bool absolute, bool quaternion, const CSPK2Range &range, float (*out)[4])
+{
+    const __m128i mask10 = _mm_set1_epi32(0x3ff);
+    const __m128i mask11 = _mm_set1_epi32(0x7ff);
+    __m128i lo = _mm_loadu_si128((const __m128i *)words);
+    __m128i ix = _mm_and_si128(lo, mask10);
+    __m128i iy = _mm_and_si128(_mm_srli_epi32(lo, 10), mask11);
+    __m128i iz = _mm_srli_epi32(lo, 21);
+    if (absolute)
+    {
+        __m128i hi = _mm_loadu_si128((const __m128i *)(words + 4));
+        ix = _mm_or_si128(_mm_slli_epi32(_mm_and_si128(hi, mask10), 10), ix);
+        iy = _mm_or_si128(_mm_slli_epi32(_mm_and_si128(_mm_srli_epi32(hi, 10), mask11), 11), iy);
+        iz = _mm_or_si128(_mm_slli_epi32(_mm_srli_epi32(hi, 21), 11), iz);
+    }
+
+    __m128 x = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(ix), _mm_set1_ps(range.scale[0])), _mm_set1_ps(range.offset[0]));
+    __m128 y = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(iy), _mm_set1_ps(range.scale[1])), _mm_set1_ps(range.offset[1]));
+    __m128 z = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(iz), _mm_set1_ps(range.scale[2])), _mm_set1_ps(range.offset[2]));
+    __m128 w = _mm_setzero_ps();
+    if (quaternion)
+    {
+        w = _mm_sub_ps(_mm_sub_ps(_mm_sub_ps(_mm_set1_ps(1.0f), _mm_mul_ps(x, x)), _mm_mul_ps(y, y)), _mm_mul_ps(z, z));
+        w = _mm_sqrt_ps(_mm_max_ps(w, _mm_setzero_ps()));
+    }
+
+    _MM_TRANSPOSE4_PS(x, y, z, w);
+    _mm_storeu_ps(out[0], x);
+    _mm_storeu_ps(out[1], y);
+    _mm_storeu_ps(out[2], z);
+    _mm_storeu_ps(out[3], w);
+}
+#else
+static void UnpackBlock(const uint32_t *words, bool absolute, bool quaternion, const CSPK2Range &range, float (*out)[4])
+{
+    for (uint32_t i = 0; i < 4; ++i)
+    {
+        uint32_t x = words[i] & 0x3ff;
+        uint32_t y = words[i] >> 10 & 0x7ff;
+        uint32_t z = words[i] >> 21;
+        if (absolute)
+        {
+            x |= (words[4 + i] & 0x3ff) << 10;
+            y |= (words[4 + i] >> 10 & 0x7ff) << 11;
+            z |= (words[4 + i] >> 21) << 11;
+        }
+        out[i][0] = (float)x * range.scale[0] + range.offset[0];
+        out[i][1] = (float)y * range.scale[1] + range.offset[1];
+        out[i][2] = (float)z * range.scale[2] + range.offset[2];
+        out[i][3] = 0.0f;
+        if (quaternion)
+        {
+            float w = ((1.0f - out[i][0] * out[i][0]) - out[i][1] * out[i][1]) - out[i][2] * out[i][2];
+            out[i][3] = w > 0.0f ? sqrtf(w) : 0.0f;
+        }
+    }
+}
+#endif
+
+static float GetKeyTime(uint32_t key, const CSPK2Header &header)
+{
+    return (float)(key & 0xffff) * 1.525902e-05f * header.mRangeTime;
+}
+
+TTH::errno_t CSPK2Stream::Open(const TTH::CompressedSkeletonPoseKeys2 &cspk, float clipDuration)
+{
+    Close();
+    if (cspk.mpData == nullptr || cspk.mDataSize < (int64_t)(sizeof(CSPK2Header) + sizeof(int64_t)))
+    {
+        return -EINVAL;
+    }
+
+    memcpy(&header, cspk.mpData, sizeof(header));
+
+    header.mRangeVector.x *= 9.536752e-07f;
+    header.mRangeVector.y *= 2.384186e-07f;
+    header.mRangeVector.z *= 2.384186e-07f;
+
+    header.mRangeDeltaV.x *= 0.0009775171f;
+    header.mRangeDeltaV.y *= 0.0004885198f;
+    header.mRangeDeltaV.z *= 0.0004885198f;
+
+    header.mRangeDeltaQ.x *= 0.0009775171f;
+    header.mRangeDeltaQ.y *= 0.0004885198f;
+    header.mRangeDeltaQ.z *= 0.0004885198f;
+
+    const uint8_t *dataEnd = cspk.mpData + cspk.mDataSize;
+    sampleBegin = cspk.mpData + sizeof(header) + sizeof(int64_t);
+    sampleEnd = sampleBegin + header.mSampleDataSize;
+    keyBegin = (const uint32_t *)(sampleEnd + header.mBoneCount * sizeof(uint64_t));
+    keyEnd = (const uint32_t *)dataEnd;
+    if ((const uint8_t *)keyBegin > dataEnd)
+    {
+        Close();
+        return -EINVAL;
+    }
+
+    duration = clipDuration;
+    boneCRC64.resize(header.mBoneCount);
+    memcpy(boneCRC64.data(), sampleEnd, header.mBoneCount * sizeof(uint64_t));
+    translations.resize(header.mBoneCount);
+    translationTimes.resize(header.mBoneCount);
+    rotations.resize(header.mBoneCount);
+    rotationTimes.resize(header.mBoneCount);
+    previousTranslations.resize(header.mBoneCount);
+    previousTranslationTimes.resize(header.mBoneCount);
+    previousRotations.resize(header.mBoneCount);
+    previousRotationTimes.resize(header.mBoneCount);
+    Rewind();
+    return 0;
+}
+
+void CSPK2Stream::Close()
+{
+    header = {};
+    sampleBegin = sampleData = sampleEnd = nullptr;
+    keyBegin = key = keyEnd = nullptr;
+    duration = 0.0f;
+    decodedTime = -1.0f;
+    boneCRC64.clear();
+    translations.clear();
+    translationTimes.clear();
+    rotations.clear();
+    rotationTimes.clear();
+    previousTranslations.clear();
+    previousTranslationTimes.clear();
+    previousRotations.clear();
+    previousRotationTimes.clear();
+}
+
+void CSPK2Stream::Rewind()
+{
+    sampleData = sampleBegin;
+    key = keyBegin;
+    blocks = CSPK2Blocks{};
+    decodedTime = -1.0f;
+    std::fill(translations.begin(), translations.end(), glm::vec3(0.0f));
+    std::fill(translationTimes.begin(), translationTimes.end(), -1.0f);
+    std::fill(rotations.begin(), rotations.end(), glm::quat(1.0f, 0.0f, 0.0f, 0.0f));
+    std::fill(rotationTimes.begin(), rotationTimes.end(), -1.0f);
+    std::fill(previousTranslations.begin(), previousTranslations.end(), glm::vec3(0.0f));
+    std::fill(previousTranslationTimes.begin(), previousTranslationTimes.end(), -1.0f);
+    std::fill(previousRotations.begin(), previousRotations.end(), glm::quat(1.0f, 0.0f, 0.0f, 0.0f));
+    std::fill(previousRotationTimes.begin(), previousRotationTimes.end(), -1.0f);
+}
+
+// Returns the sample key refers to, unpacking the next block of its kind from data into blocks when the staged one is used up
+static TTH::errno_t ReadSample(uint32_t key, const CSPK2Header &header, const uint8_t *&data, const uint8_t *end, CSPK2Blocks &blocks, const float *&sample)
+{
+    bool delta = (int32_t)key < 0;
+    bool quaternion = (key & 0x40000000) != 0;
+    uint32_t &staged = quaternion ? (delta ? blocks.stagedDelQ : blocks.stagedAbsQ) : (delta ? blocks.stagedDelV : blocks.stagedAbsV);
+    float(*samples)[4] = quaternion ? (delta ? blocks.delQ : blocks.absQ) : (delta ? blocks.delV : blocks.absV);
+    if (staged > 3)
+    {
+        size_t blockSize = delta ? 4 * sizeof(uint32_t) : 8 * sizeof(uint32_t);
+        if (data + blockSize > end)
+        {
+            return -EINVAL;
+        }
+        if (quaternion)
+        {
+            UnpackBlock((const uint32_t *)data, !delta, true, delta ? MakeRange(header.mRangeDeltaQ, header.mMinDeltaQ) : ABSOLUTE_QUATERNION_RANGE, samples);
+        }
+        else
+        {
+            UnpackBlock((const uint32_t *)data, !delta, false, delta ? MakeRange(header.mRangeDeltaV, header.mMinDeltaV) : MakeRange(header.mRangeVector, header.mMinVector),
+                        samples);
+        }
+        data += blockSize;
+        staged = 0;
+    }
+    sample = samples[staged++];
+    return 0;
+}
+
+// Delta keys are relative to the previous key of the same bone
+static glm::vec3 MakeTranslation(uint32_t key, const float *sample, const glm::vec3 &previous)
+{
+    glm::vec3 value(sample[0], sample[1], sample[2]);
+    return (int32_t)key < 0 ? value + previous : value;
+}
+
+static glm::quat MakeRotation(uint32_t key, const float *sample, const glm::quat &previous)
+{
+    if ((int32_t)key < 0)
+    {
+        return glm::quat(sample[3], sample[0], sample[1], sample[2]) * previous;
+    }
+    // Components are stored in stream order, the key's axis order decides which of them is w
+    uint32_t axisOrder = key >> 0x1c & 3;
+    return glm::quat(sample[axisOrder], sample[axisOrder ^ 1], sample[axisOrder ^ 2], sample[axisOrder ^ 3]);
+}
+
+float CSPK2Stream::GetCursorTime() const
+{
+    if (key >= keyEnd || ((*key >> 0x10) & 0xfff) >= header.mBoneCount)
+    {
+        return -1.0f;
+    }
+    uint32_t bone = (*key >> 0x10) & 0xfff;
+    return (*key & 0x40000000) ? rotationTimes[bone] : translationTimes[bone];
+}
+
+TTH::errno_t CSPK2Stream::DecodeKey()
+{
+    uint32_t bone = (*key >> 0x10) & 0xfff;
+    if (bone >= header.mBoneCount)
+    {
+        return -EINVAL;
+    }
+    const float *sample;
+    TTH::errno_t err = ReadSample(*key, header, sampleData, sampleEnd, blocks, sample);
+    if (err < 0)
+    {
+        return err;
+    }
+    if ((*key & 0x40000000) == 0)
+    {
+        previousTranslations[bone] = translations[bone];
+        previousTranslationTimes[bone] = translationTimes[bone];
+        translations[bone] = MakeTranslation(*key, sample, translations[bone]);
+        translationTimes[bone] = GetKeyTime(*key, header);
+    }
+    else
+    {
+        previousRotations[bone] = rotations[bone];
+        previousRotationTimes[bone] = rotationTimes[bone];
+        rotations[bone] = MakeRotation(*key, sample, rotations[bone]);
+        rotationTimes[bone] = GetKeyTime(*key, header);
+    }
+    ++key;
+    return 0;
+}
+
+TTH::errno_t CSPK2Stream::Advance(float time)
+{
+    if (time < decodedTime)
+    {
+        Seek(time);
+    }
+    else if (seekIndex != nullptr)
+    {
+        // Skip ahead when a checkpoint lies between the decoded and the requested time
+        const CSPK2Checkpoint *checkpoint = seekIndex->Find(time);
+        if (checkpoint != nullptr && checkpoint->keyOffset > key - keyBegin)
+        {
+            Seek(time);
+        }
+    }
+    // Stops at the first key whose bone is already decoded past time, keys are ordered by that time so all the ones after it are too
+    while (key < keyEnd && GetCursorTime() <= time)
+    {
+        TTH::errno_t err = DecodeKey();
+        if (err < 0)
+        {
+            return err;
+        }
+    }
+    decodedTime = time;
+    return 0;
+}
+
+void CSPK2Stream::Seek(float time)
+{
+    const CSPK2Checkpoint *checkpoint = seekIndex != nullptr ? seekIndex->Find(time) : nullptr;
+    if (checkpoint == nullptr || seekIndex->boneCount != GetBoneCount())
+    {
+        Rewind();
+        return;
+    }
+
+    size_t first = (checkpoint - seekIndex->checkpoints.data()) * GetBoneCount();
+    key = keyBegin + checkpoint->keyOffset;
+    sampleData = sampleBegin + checkpoint->sampleOffset;
+    blocks = checkpoint->blocks;
+    decodedTime = checkpoint->time;
+    std::copy_n(seekIndex->translations.begin() + first, GetBoneCount(), translations.begin());
+    std::copy_n(seekIndex->translationTimes.begin() + first, GetBoneCount(), translationTimes.begin());
+    std::copy_n(seekIndex->rotations.begin() + first, GetBoneCount(), rotations.begin());
+    std::copy_n(seekIndex->rotationTimes.begin() + first, GetBoneCount(), rotationTimes.begin());
+    std::copy_n(seekIndex->previousTranslations.begin() + first, GetBoneCount(), previousTranslations.begin());
+    std::copy_n(seekIndex->previousTranslationTimes.begin() + first, GetBoneCount(), previousTranslationTimes.begin());
+    std::copy_n(seekIndex->previousRotations.begin() + first, GetBoneCount(), previousRotations.begin());
+    std::copy_n(seekIndex->previousRotationTimes.begin() + first, GetBoneCount(), previousRotationTimes.begin());
+}
+
+// Same blend AnimationTracks::Sample uses between a key and the one after it
+static float GetStreamBlend(float previousTime, float time, float decodedTime)
+{
+    if (time <= previousTime)
+    {
+        return 0.0f;
+    }
+    return std::clamp((decodedTime - previousTime) / (time - previousTime), 0.0f, 1.0f);
+}
+
+void CSPK2Stream::Sample(glm::vec3 *outTranslations, glm::quat *outRotations) const
+{
+    for (size_t i = 0; i < boneCRC64.size(); ++i)
+    {
+        // Bones before their first key or past their last one hold it
+        if (previousTranslationTimes[i] >= 0.0f && decodedTime < translationTimes[i])
+        {
+            float t = GetStreamBlend(previousTranslationTimes[i], translationTimes[i], decodedTime);
+            outTranslations[i] = t > 0.0f ? glm::mix(previousTranslations[i], translations[i], t) : previousTranslations[i];
+        }
+        else if (translationTimes[i] >= 0.0f)
+        {
+            outTranslations[i] = translations[i];
+        }
+        if (previousRotationTimes[i] >= 0.0f && decodedTime < rotationTimes[i])
+        {
+            float t = GetStreamBlend(previousRotationTimes[i], rotationTimes[i], decodedTime);
+            outRotations[i] = t > 0.0f ? Nlerp(previousRotations[i], rotations[i], t) : previousRotations[i];
+        }
+        else if (rotationTimes[i] >= 0.0f)
+        {
+            outRotations[i] = rotations[i];
+        }
+    }
+}
+
+TTH::errno_t CSPK2SeekIndex::Build(const TTH::CompressedSkeletonPoseKeys2 &cspk, float duration, uint32_t keyInterval, float timeInterval)
+{
+    Clear();
+    CSPK2Stream stream;
+    TTH::errno_t err = stream.Open(cspk, duration);
+    if (err < 0)
+    {
+        return err;
+    }
+
+    boneCount = stream.GetBoneCount();
+    uint32_t keysSinceCheckpoint = 0;
+    float lastCheckpointTime = 0.0f;
+    // Highest cursor time decoded so far, restoring a checkpoint is only valid for Advance to this time or later
+    float time = -1.0f;
+    while (stream.key < stream.keyEnd)
+    {
+        // Checkpoints are taken in front of a key, restoring one leaves exactly the keys before it decoded
+        if (keysSinceCheckpoint >= keyInterval || time - lastCheckpointTime >= timeInterval)
+        {
+            checkpoints.push_back(CSPK2Checkpoint{
+                .time = time,
+                .keyOffset = static_cast<uint32_t>(stream.key - stream.keyBegin),
+                .sampleOffset = static_cast<uint32_t>(stream.sampleData - stream.sampleBegin),
+                .blocks = stream.blocks,
+            });
+            translations.insert(translations.end(), stream.translations.begin(), stream.translations.end());
+            translationTimes.insert(translationTimes.end(), stream.translationTimes.begin(), stream.translationTimes.end());
+            rotations.insert(rotations.end(), stream.rotations.begin(), stream.rotations.end());
+            rotationTimes.insert(rotationTimes.end(), stream.rotationTimes.begin(), stream.rotationTimes.end());
+            previousTranslations.insert(previousTranslations.end(), stream.previousTranslations.begin(), stream.previousTranslations.end());
+            previousTranslationTimes.insert(previousTranslationTimes.end(), stream.previousTranslationTimes.begin(), stream.previousTranslationTimes.end());
+            previousRotations.insert(previousRotations.end(), stream.previousRotations.begin(), stream.previousRotations.end());
+            previousRotationTimes.insert(previousRotationTimes.end(), stream.previousRotationTimes.begin(), stream.previousRotationTimes.end());
+            keysSinceCheckpoint = 0;
+            lastCheckpointTime = time;
+        }
+
+        time = std::max(time, stream.GetCursorTime());
+        err = stream.DecodeKey();
+        if (err < 0)
+        {
+            Clear();
+            return err;
+        }
+        ++keysSinceCheckpoint;
+    }
+
+    TTH_LOG_INFO("CSPK2 seek index: %zu checkpoints over %zu keys, %zu bytes\n", checkpoints.size(), stream.GetKeyCount(), GetMemoryUsage());
+    return 0;
+}
+
+void CSPK2SeekIndex::Clear()
+{
+    checkpoints.clear();
+    boneCount = 0;
+    translations.clear();
+    translationTimes.clear();
+    rotations.clear();
+    rotationTimes.clear();
+    previousTranslations.clear();
+    previousTranslationTimes.clear();
+    previousRotations.clear();
+    previousRotationTimes.clear();
+}
+
+const CSPK2Checkpoint *CSPK2SeekIndex::Find(float time) const
+{
+    auto it = std::upper_bound(checkpoints.begin(), checkpoints.end(), time, [](float t, const CSPK2Checkpoint &checkpoint) { return t < checkpoint.time; });
+    return it == checkpoints.begin() ? nullptr : &*(it - 1);
+}
+
+size_t CSPK2SeekIndex::GetMemoryUsage() const
+{
+    return checkpoints.size() * sizeof(CSPK2Checkpoint) + translations.size() * sizeof(glm::vec3) + translationTimes.size() * sizeof(float) +
+           rotations.size() * sizeof(glm::quat) + rotationTimes.size() * sizeof(float) + previousTranslations.size() * sizeof(glm::vec3) +
+           previousTranslationTimes.size() * sizeof(float) + previousRotations.size() * sizeof(glm::quat) + previousRotationTimes.size() * sizeof(float);
+}
+
+TTH::errno_t DescribeCSPK2(const CSPK2Stream &stream, AnimationTracks &tracks)
+{
+    tracks.Clear();
+    tracks.duration = stream.duration;
+    tracks.boneCRC64 = stream.boneCRC64;
+
+    // Only reads the key headers to count the keys of every track
+    tracks.translationOffsets.assign(stream.GetBoneCount() + 1, 0);
+    tracks.rotationOffsets.assign(stream.GetBoneCount() + 1, 0);
+    for (const uint32_t *key = stream.keyBegin; key < stream.keyEnd; ++key)
+    {
+        uint32_t bone = (*key >> 0x10) & 0xfff;
+        if (bone >= stream.GetBoneCount())
+        {
+            tracks.Clear();
+            return -EINVAL;
+        }
+        ++((*key & 0x40000000) ? tracks.rotationOffsets : tracks.translationOffsets)[bone + 1];
+    }
+    for (size_t i = 0; i < stream.GetBoneCount(); ++i)
+    {
+        tracks.translationOffsets[i + 1] += tracks.translationOffsets[i];
+        tracks.rotationOffsets[i + 1] += tracks.rotationOffsets[i];
+    }
+    tracks.baseTranslations.assign(stream.GetBoneCount(), glm::vec3(0.0f));
+    tracks.baseRotations.assign(stream.GetBoneCount(), glm::quat(1.0f, 0.0f, 0.0f, 0.0f));
+    return 0;
+}
+
+TTH::errno_t DecodeCSPK2(const TTH::CompressedSkeletonPoseKeys2 &cspk, float duration, AnimationTracks &tracks)
+{
+    CSPK2Stream stream;
+    TTH::errno_t err = stream.Open(cspk, duration);
+    if (err < 0)
+    {
+        return err;
+    }
+
+    // Sizes every track before the keys are filled in
+    err = DescribeCSPK2(stream, tracks);
+    if (err < 0)
+    {
+        return err;
+    }
+    tracks.translationTimes.resize(tracks.translationOffsets.back());
+    tracks.translations.resize(tracks.translationOffsets.back());
+    tracks.rotationTimes.resize(tracks.rotationOffsets.back());
+    tracks.rotations.resize(tracks.rotationOffsets.back());
+
+    std::vector<uint32_t> translationCursor(tracks.translationOffsets.begin(), tracks.translationOffsets.end() - 1);
+    std::vector<uint32_t> rotationCursor(tracks.rotationOffsets.begin(), tracks.rotationOffsets.end() - 1);
+
+    // Delta keys are relative to the previous key of the same bone, so the stream has to be walked in order once
+    while (stream.key < stream.keyEnd)
+    {
+        uint32_t key = *stream.key;
+        uint32_t bone = (key >> 0x10) & 0xfff;
+        err = stream.DecodeKey();
+        if (err < 0)
+        {
+            tracks.Clear();
+            return err;
+        }
+        if ((key & 0x40000000) == 0)
+        {
+            tracks.translationTimes[translationCursor[bone]] = stream.translationTimes[bone];
+            tracks.translations[translationCursor[bone]] = stream.translations[bone];
+            ++translationCursor[bone];
+        }
+        else
+        {
+            tracks.rotationTimes[rotationCursor[bone]] = stream.rotationTimes[bone];
+            tracks.rotations[rotationCursor[bone]] = stream.rotations[bone];
+            ++rotationCursor[bone];
+        }
+    }
+
+    tracks.FindAnimatedTracks();
+    return 0;
+}
@@ -0,0 +1,521 @@
+#include <algorithm>
+#include <bit>
+#include <ttc/render/deviceallocator.hpp>
+#include <tth/core/log.hpp>
+
+static VkDeviceSize AlignAllocation(VkDeviceSize value, VkDeviceSize alignment) { return alignment > 1 ? (value + alignment - 1) / alignment * alignment : value; }
+
+// Bin of a free segment of size bytes. Segments below SL_COUNT bytes share the first bin and are only used when they happen to fit.
+static void MapSize(VkDeviceSize size, uint32_t &fl, uint32_t &sl)
+{
+    size = std::max<VkDeviceSize>(size, DeviceAllocator::SL_COUNT);
+    fl = static_cast<uint32_t>(std::bit_width(size)) - 1;
+    sl = static_cast<uint32_t>(size >> (fl - DeviceAllocator::SL_LOG2)) - DeviceAllocator::SL_COUNT;
+}
+
+void DeviceAllocator::Init(VkPhysicalDevice physicalDevice)
+{
+    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+    bufferImageGranularity = std::max<VkDeviceSize>(properties.limits.bufferImageGranularity, 1);
+    nonCoherentAtomSize = std::max<VkDeviceSize>(properties.limits.nonCoherentAtomSize, 1);
+    maxMemoryAllocationCount = properties.limits.maxMemoryAllocationCount;
+    records.assign(1, Record{});
+}
+
+void DeviceAllocator::Destroy(VkDevice device)
+{
+    for (uint32_t i = 0; i < blocks.size(); ++i)
+    {
+        if (blocks[i] != nullptr)
+        {
+            ReleaseBlock(device, i);
+        }
+    }
+    blocks.clear();
+    records.assign(1, Record{});
+    freeIds.clear();
+    categoryStats = {};
+}
+
+VkDeviceSize DeviceAllocator::GetBlockSize(uint32_t memoryType) const
+{
+    VkDeviceSize heapSize = memProperties.memoryHeaps[memProperties.memoryTypes[memoryType].heapIndex].size;
+    return std::min(preferredBlockSize, std::max<VkDeviceSize>(heapSize / 8, VkDeviceSize(1) << 20));
+}
+
+VkResult DeviceAllocator::CreateBlock(VkDevice device, uint32_t memoryType, VkDeviceSize size, bool dedicated, uint32_t &blockIndex)
+{
+    if (deviceAllocationCount >= maxMemoryAllocationCount)
+    {
+        return VkResult::VK_ERROR_TOO_MANY_OBJECTS;
+    }
+
+    std::unique_ptr<Block> block = std::make_unique<Block>();
+    VkMemoryAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.allocationSize = size;
+    allocInfo.memoryTypeIndex = memoryType;
+    VkResult err = vkAllocateMemory(device, &allocInfo, nullptr, &block->memory);
+    if (err != VkResult::VK_SUCCESS)
+    {
+        return err;
+    }
+    if (memProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+    {
+        void *data;
+        err = vkMapMemory(device, block->memory, 0, VK_WHOLE_SIZE, 0, &data);
+        if (err != VkResult::VK_SUCCESS)
+        {
+            vkFreeMemory(device, block->memory, nullptr);
+            return err;
+        }
+        block->mapped = static_cast<uint8_t *>(data);
+    }
+    block->size = size;
+    block->memoryType = memoryType;
+    block->dedicated = dedicated;
+    block->bins.resize(FL_COUNT * SL_COUNT);
+    // A dedicated block is handed out whole, its only segment is filled in by the caller
+    if (!dedicated)
+    {
+        block->segments[0] = Segment{size, 0, true};
+        InsertFree(*block, 0, size);
+    }
+    ++deviceAllocationCount;
+
+    auto slot = std::find(blocks.begin(), blocks.end(), nullptr);
+    blockIndex = static_cast<uint32_t>(slot - blocks.begin());
+    if (slot == blocks.end())
+    {
+        blocks.push_back(std::move(block));
+    }
+    else
+    {
+        *slot = std::move(block);
+    }
+    return VkResult::VK_SUCCESS;
+}
+
+void DeviceAllocator::ReleaseBlock(VkDevice device, uint32_t blockIndex)
+{
+    // Freeing the memory unmaps it as well
+    vkFreeMemory(device, blocks[blockIndex]->memory, nullptr);
+    blocks[blockIndex].reset();
+    --deviceAllocationCount;
+}
+
+void DeviceAllocator::InsertFree(Block &block, VkDeviceSize offset, VkDeviceSize size)
+{
+    uint32_t fl, sl;
+    MapSize(size, fl, sl);
+    block.bins[fl * SL_COUNT + sl].insert(offset);
+    block.firstLevel |= uint64_t(1) << fl;
+    block.secondLevel[fl] |= 1u << sl;
+}
+
+void DeviceAllocator::RemoveFree(Block &block, VkDeviceSize offset, VkDeviceSize size)
+{
+    uint32_t fl, sl;
+    MapSize(size, fl, sl);
+    std::set<VkDeviceSize> &bin = block.bins[fl * SL_COUNT + sl];
+    bin.erase(offset);
+    if (bin.empty())
+    {
+        block.secondLevel[fl] &= ~(1u << sl);
+        if (block.secondLevel[fl] == 0)
+        {
+            block.firstLevel &= ~(uint64_t(1) << fl);
+        }
+    }
+}
+
+bool DeviceAllocator::AllocateFromBlock(uint32_t blockIndex, VkDeviceSize size, VkDeviceSize alignment, bool linear, VkDeviceSize &offset)
+{
+    Block &block = *blocks[blockIndex];
+
+    // Start at the first bin whose every segment is at least size, smaller bins are skipped even if one of their segments would fit
+    VkDeviceSize search = std::max<VkDeviceSize>(size, SL_COUNT);
+    search += (VkDeviceSize(1) << (std::bit_width(search) - 1 - SL_LOG2)) - 1;
+    uint32_t fl, sl;
+    MapSize(search, fl, sl);
+    if (fl >= FL_COUNT)
+    {
+        return false;
+    }
+
+    uint32_t bin = fl * SL_COUNT + sl;
+    while (bin < FL_COUNT * SL_COUNT)
+    {
+        fl = bin / SL_COUNT;
+        sl = bin % SL_COUNT;
+        uint32_t slMap = block.secondLevel[fl] & (~0u << sl);
+        if (slMap == 0)
+        {
+            uint64_t flMap = fl + 1 < FL_COUNT ? block.firstLevel & (~uint64_t(0) << (fl + 1)) : 0;
+            if (flMap == 0)
+            {
+                return false;
+            }
+            fl = static_cast<uint32_t>(std::countr_zero(flMap));
+            slMap = block.secondLevel[fl];
+        }
+        sl = static_cast<uint32_t>(std::countr_zero(slMap));
+        bin = fl * SL_COUNT + sl;
+
+        // Alignment and granularity padding can still make a segment too small, so every candidate is checked
+        for (VkDeviceSize candidate : block.bins[bin])
+        {
+            auto segment = block.segments.find(candidate);
+            VkDeviceSize segmentEnd = candidate + segment->second.size;
+            VkDeviceSize begin = AlignAllocation(candidate, alignment);
+            // Free segments never touch, so the neighbors on both sides are allocated
+            if (bufferImageGranularity > 1 && segment != block.segments.begin())
+            {
+                auto previous = std::prev(segment);
+                if (previous->second.linear != linear && (previous->first + previous->second.size - 1) / bufferImageGranularity == begin / bufferImageGranularity)
+                {
+                    begin = AlignAllocation(begin, bufferImageGranularity);
+                }
+            }
+            if (begin + size > segmentEnd)
+            {
+                continue;
+            }
+            auto next = std::next(segment);
+            if (bufferImageGranularity > 1 && next != block.segments.end() && next->second.linear != linear &&
+                (begin + size - 1) / bufferImageGranularity == next->first / bufferImageGranularity)
+            {
+                continue;
+            }
+
+            RemoveFree(block, candidate, segment->second.size);
+            if (begin > candidate)
+            {
+                segment->second.size = begin - candidate;
+                InsertFree(block, candidate, begin - candidate);
+            }
+            else
+            {
+                block.segments.erase(segment);
+            }
+            // Marked taken, the caller fills in the id
+            block.segments[begin] = Segment{size, ~0u, linear};
+            if (begin + size < segmentEnd)
+            {
+                block.segments[begin + size] = Segment{segmentEnd - begin - size, 0, true};
+                InsertFree(block, begin + size, segmentEnd - begin - size);
+            }
+            block.used += size;
+            offset = begin;
+            return true;
+        }
+        ++bin;
+    }
+    return false;
+}
+
+uint32_t DeviceAllocator::AddRecord(const Record &record)
+{
+    if (freeIds.empty())
+    {
+        records.push_back(record);
+        return static_cast<uint32_t>(records.size() - 1);
+    }
+    uint32_t id = freeIds.back();
+    freeIds.pop_back();
+    records[id] = record;
+    return id;
+}
+
+MemoryAllocation DeviceAllocator::Describe(uint32_t id) const
+{
+    const Record &record = records[id];
+    const Block &block = *blocks[record.block];
+    MemoryAllocation allocation;
+    allocation.memory = block.memory;
+    allocation.offset = record.offset;
+    allocation.size = record.size;
+    allocation.mapped = block.mapped != nullptr ? block.mapped + record.offset : nullptr;
+    allocation.memoryType = block.memoryType;
+    allocation.id = id;
+    return allocation;
+}
+
+VkResult DeviceAllocator::Allocate(VkDevice device, const VkMemoryRequirements &requirements, VkMemoryPropertyFlags properties, MemoryCategory category, bool linear,
+                                   bool movable, MemoryAllocation &out)
+{
+    out = MemoryAllocation{};
+    VkResult err = VkResult::VK_ERROR_OUT_OF_DEVICE_MEMORY;
+    // Memory types are ordered by preference, a type whose heap is exhausted moves on to the next one that matches
+    for (uint32_t type = 0; type < memProperties.memoryTypeCount; ++type)
+    {
+        VkMemoryPropertyFlags flags = memProperties.memoryTypes[type].propertyFlags;
+        if (!(requirements.memoryTypeBits & (1u << type)) || (flags & properties) != properties)
+        {
+            continue;
+        }
+
+        VkDeviceSize size = std::max<VkDeviceSize>(requirements.size, 1);
+        VkDeviceSize alignment = std::max<VkDeviceSize>(requirements.alignment, 1);
+        if ((flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) && !(flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT))
+        {
+            alignment = std::max(alignment, nonCoherentAtomSize);
+            size = AlignAllocation(size, nonCoherentAtomSize);
+        }
+
+        uint32_t blockIndex = ~0u;
+        VkDeviceSize offset = 0;
+        VkDeviceSize blockSize = GetBlockSize(type);
+        if (size > blockSize / 2)
+        {
+            err = CreateBlock(device, type, size, true, blockIndex);
+            if (err != VkResult::VK_SUCCESS)
+            {
+                continue;
+            }
+            blocks[blockIndex]->segments[0] = Segment{size, ~0u, linear};
+            blocks[blockIndex]->used = size;
+        }
+        else
+        {
+            for (uint32_t i = 0; i < blocks.size(); ++i)
+            {
+                if (blocks[i] != nullptr && !blocks[i]->dedicated && blocks[i]->memoryType == type && AllocateFromBlock(i, size, alignment, linear, offset))
+                {
+                    blockIndex = i;
+                    break;
+                }
+            }
+            if (blockIndex == ~0u)
+            {
+                // Halve the block while the heap refuses it, as long as the request still leaves room for others
+                for (;; blockSize /= 2)
+                {
+                    err = CreateBlock(device, type, blockSize, false, blockIndex);
+                    if (err == VkResult::VK_SUCCESS || err == VkResult::VK_ERROR_TOO_MANY_OBJECTS || blockSize / 2 < size * 2)
+                    {
+                        break;
+                    }
+                }
+                if (err != VkResult::VK_SUCCESS || !AllocateFromBlock(blockIndex, size, alignment, linear, offset))
+                {
+                    continue;
+                }
+            }
+        }
+
+        Record record;
+        record.block = blockIndex;
+        record.offset = offset;
+        record.size = size;
+        record.alignment = alignment;
+        record.category = category;
+        record.linear = linear;
+        record.movable = movable;
+        uint32_t id = AddRecord(record);
+        blocks[blockIndex]->segments[offset].id = id;
+        MemoryCategoryStats &stats = categoryStats[static_cast<size_t>(category)];
+        ++stats.allocationCount;
+        stats.bytes += size;
+        out = Describe(id);
+        return VkResult::VK_SUCCESS;
+    }
+    return err;
+}
+
+VkResult DeviceAllocator::AllocateBuffer(VkDevice device, VkBuffer buffer, VkMemoryPropertyFlags properties, MemoryCategory category, MemoryAllocation &out)
+{
+    VkMemoryRequirements requirements;
+    vkGetBufferMemoryRequirements(device, buffer, &requirements);
+    VkResult err = Allocate(device, requirements, properties, category, true, true, out);
+    if (err != VkResult::VK_SUCCESS)
+    {
+        return err;
+    }
+    err = vkBindBufferMemory(device, buffer, out.memory, out.offset);
+    if (err != VkResult::VK_SUCCESS)
+    {
+        Free(device, out);
+    }
+    return err;
+}
+
+VkResult DeviceAllocator::AllocateImage(VkDevice device, VkImage image, VkImageTiling tiling, VkMemoryPropertyFlags properties, MemoryCategory category, MemoryAllocation &out)
+{
+    VkMemoryRequirements requirements;
+    vkGetImageMemoryRequirements(device, image, &requirements);
+    VkResult err = Allocate(device, requirements, properties, category, tiling == VK_IMAGE_TILING_LINEAR, false, out);
+    if (err != VkResult::VK_SUCCESS)
+    {
+        return err;
+    }
+    err = vkBindImageMemory(device, image, out.memory, out.offset);
+    if (err != VkResult::VK_SUCCESS)
+    {
+        Free(device, out);
+    }
+    return err;
+}
+
+void DeviceAllocator::Free(VkDevice device, MemoryAllocation &allocation)
+{
+    if (allocation.id == 0)
+    {
+        return;
+    }
+    Record record = records[allocation.id];
+    freeIds.push_back(allocation.id);
+    allocation = MemoryAllocation{};
+    MemoryCategoryStats &stats = categoryStats[static_cast<size_t>(record.category)];
+    --stats.allocationCount;
+    stats.bytes -= record.size;
+
+    Block &block = *blocks[record.block];
+    block.used -= record.size;
+    if (block.dedicated)
+    {
+        ReleaseBlock(device, record.block);
+        return;
+    }
+
+    // Merge with free neighbors so free segments never touch
+    auto segment = block.segments.find(record.offset);
+    VkDeviceSize offset = record.offset;
+    VkDeviceSize size = segment->second.size;
+    auto next = std::next(segment);
+    if (next != block.segments.end() && next->second.id == 0)
+    {
+        RemoveFree(block, next->first, next->second.size);
+        size += next->second.size;
+        block.segments.erase(next);
+    }
+    if (segment != block.segments.begin())
+    {
+        auto previous = std::prev(segment);
+        if (previous->second.id == 0)
+        {
+            RemoveFree(block, previous->first, previous->second.size);
+            offset = previous->first;
+            size += previous->second.size;
+            block.segments.erase(segment);
+            segment = previous;
+        }
+    }
+    segment->second = Segment{size, 0, true};
+    InsertFree(block, offset, size);
+
+    // One empty block per memory type is kept around so allocating and freeing in a loop does not hit vkAllocateMemory every time
+    if (block.used == 0)
+    {
+        for (uint32_t i = 0; i < blocks.size(); ++i)
+        {
+            if (i != record.block && blocks[i] != nullptr && !blocks[i]->dedicated && blocks[i]->memoryType == block.memoryType)
+            {
+                ReleaseBlock(device, record.block);
+                return;
+            }
+        }
+    }
+}
+
+std::vector<DefragmentMove> DeviceAllocator::Defragment(VkDeviceSize maxBytes)
+{
+    std::vector<DefragmentMove> moves;
+    VkDeviceSize movedBytes = 0;
+    // Blocks that took moved allocations are never emptied in the same pass, the contents of those allocations only arrive once the caller copies them
+    std::vector<bool> received(blocks.size(), false);
+    for (uint32_t type = 0; type < memProperties.memoryTypeCount; ++type)
+    {
+        std::vector<uint32_t> order;
+        for (uint32_t i = 0; i < blocks.size(); ++i)
+        {
+            if (blocks[i] != nullptr && !blocks[i]->dedicated && blocks[i]->memoryType == type)
+            {
+                order.push_back(i);
+            }
+        }
+        std::sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) { return blocks[a]->used > blocks[b]->used; });
+
+        // Empties the sparsest blocks into the fuller ones, a block only ever receives from blocks behind it in order
+        for (size_t source = order.size(); source-- > 1;)
+        {
+            if (received[order[source]])
+            {
+                continue;
+            }
+            std::vector<uint32_t> ids;
+            for (const auto &[offset, segment] : blocks[order[source]]->segments)
+            {
+                if (segment.id != 0 && records[segment.id].movable)
+                {
+                    ids.push_back(segment.id);
+                }
+            }
+            for (uint32_t id : ids)
+            {
+                Record record = records[id];
+                if (movedBytes + record.size > maxBytes)
+                {
+                    return moves;
+                }
+                for (size_t target = 0; target < source; ++target)
+                {
+                    VkDeviceSize offset;
+                    if (!AllocateFromBlock(order[target], record.size, record.alignment, record.linear, offset))
+                    {
+                        continue;
+                    }
+                    Record moved = record;
+                    moved.block = order[target];
+                    moved.offset = offset;
+                    uint32_t movedId = AddRecord(moved);
+                    blocks[moved.block]->segments[offset].id = movedId;
+                    MemoryCategoryStats &stats = categoryStats[static_cast<size_t>(record.category)];
+                    ++stats.allocationCount;
+                    stats.bytes += record.size;
+                    moves.push_back(DefragmentMove{Describe(id), Describe(movedId)});
+                    movedBytes += record.size;
+                    received[moved.block] = true;
+                    break;
+                }
+            }
+        }
+    }
+    return moves;
+}
+
+void DeviceAllocator::LogStats() const
+{
+    static const char *categoryNames[] = {"vertex", "index", "indirect", "uniform", "storage", "staging", "depth", "other"};
+    TTH_LOG_INFO("Device memory: %u of %u allocations\n", deviceAllocationCount, maxMemoryAllocationCount);
+    for (uint32_t type = 0; type < memProperties.memoryTypeCount; ++type)
+    {
+        uint32_t blockCount = 0;
+        VkDeviceSize reserved = 0;
+        VkDeviceSize used = 0;
+        for (const std::unique_ptr<Block> &block : blocks)
+        {
+            if (block != nullptr && block->memoryType == type)
+            {
+                ++blockCount;
+                reserved += block->size;
+                used += block->used;
+            }
+        }
+        if (blockCount > 0)
+        {
+            TTH_LOG_INFO("  type %u: %u blocks, %llu of %llu bytes used\n", type, blockCount, static_cast<unsigned long long>(used),
+                         static_cast<unsigned long long>(reserved));
+        }
+    }
+    for (size_t i = 0; i < categoryStats.size(); ++i)
+    {
+        if (categoryStats[i].allocationCount > 0)
+        {
+            TTH_LOG_INFO("  %s: %llu allocations, %llu bytes\n", categoryNames[i], static_cast<unsigned long long>(categoryStats[i].allocationCount),
+                         static_cast<unsigned long long>(categoryStats[i].bytes));
+        }
+    }
+}
@@ -0,0 +1,95 @@
+#include <algorithm>
+#include <ttc/render/framering.hpp>
+
+static VkDeviceSize AlignRing(VkDeviceSize value, VkDeviceSize alignment) { return alignment > 1 ? (value + alignment - 1) / alignment * alignment : value; }
+
+VkResult FrameRing::Init(VkDevice device, DeviceAllocator &allocator, VkDeviceSize frameSize, uint32_t frameCount, VkBufferUsageFlags usage)
+{
+    nonCoherentAtomSize = allocator.nonCoherentAtomSize;
+
+    // Regions start on a boundary every offset alignment and flush granularity divides
+    this->frameSize = AlignRing(frameSize, 256);
+    this->frameCount = frameCount;
+
+    VkBufferCreateInfo bufferInfo{
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size = this->frameSize * frameCount,
+        .usage = usage,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+    };
+    VkResult err = vkCreateBuffer(device, &bufferInfo, nullptr, &buffer);
+    if (err != VkResult::VK_SUCCESS)
+    {
+        return err;
+    }
+
+    constexpr VkMemoryPropertyFlags preferences[] = {
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+    };
+    // Device local host visible memory can be a small heap on discrete GPUs without resizable BAR, an allocation failing there moves on to the next choice
+    for (VkMemoryPropertyFlags preference : preferences)
+    {
+        err = allocator.AllocateBuffer(device, buffer, preference, MemoryCategory::Uniform, allocation);
+        if (err == VkResult::VK_SUCCESS)
+        {
+            VkMemoryPropertyFlags flags = allocator.memProperties.memoryTypes[allocation.memoryType].propertyFlags;
+            coherent = flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+            deviceLocal = flags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+            break;
+        }
+    }
+    if (err != VkResult::VK_SUCCESS)
+    {
+        return err;
+    }
+
+    // The allocator keeps host visible blocks mapped
+    mapped = allocation.mapped;
+    BeginFrame(0);
+    return VkResult::VK_SUCCESS;
+}
+
+void FrameRing::Destroy(VkDevice device, DeviceAllocator &allocator)
+{
+    vkDestroyBuffer(device, buffer, nullptr);
+    allocator.Free(device, allocation);
+    buffer = VK_NULL_HANDLE;
+    mapped = nullptr;
+}
+
+void FrameRing::BeginFrame(uint32_t frame)
+{
+    this->frame = frame;
+    head = frameSize * frame;
+}
+
+void *FrameRing::Allocate(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize &offset)
+{
+    VkDeviceSize begin = AlignRing(head, alignment);
+    if (begin + size > frameSize * (frame + 1))
+    {
+        return nullptr;
+    }
+    offset = begin;
+    head = begin + size;
+    return mapped + begin;
+}
+
+VkResult FrameRing::Flush(VkDevice device) const
+{
+    VkDeviceSize begin = frameSize * frame;
+    if (coherent || head == begin)
+    {
+        return VkResult::VK_SUCCESS;
+    }
+    VkMappedMemoryRange range{};
+    range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+    // The allocator rounds the allocation of non-coherent memory to whole atoms, so the range stays inside it
+    range.memory = allocation.memory;
+    range.offset = allocation.offset + begin;
+    range.size = std::min(AlignRing(head - begin, nonCoherentAtomSize), allocation.size - begin);
+    return vkFlushMappedMemoryRanges(device, 1, &range);
+}
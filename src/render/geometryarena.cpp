@@ -0,0 +1,129 @@
+#include <algorithm>
+#include <ttc/render/geometryarena.hpp>
+
+static VkDeviceSize AlignArena(VkDeviceSize value) { return (value + 3) & ~VkDeviceSize(3); }
+
+// Same stride the pipeline's vertex bindings use, the end of the stream's last attribute
+static uint32_t GetStreamStride(const TTH::D3DMesh &mesh, size_t stream)
+{
+    TTH::D3DMesh::AttributeDescription attributes[32];
+    mesh.GetVertexBuffer(stream, 0, 0, attributes);
+    size_t attributeCount = mesh.GetVertexBufferAttributeCount(stream);
+    if (attributeCount == 0)
+    {
+        return 0;
+    }
+    return attributes[attributeCount - 1].offset + static_cast<uint32_t>(TTH::D3DMesh::GetFormatStride(attributes[attributeCount - 1].format));
+}
+
+bool GeometryArena::Build(const TTH::D3DMesh *const *meshes, size_t meshCount)
+{
+    this->meshes.assign(meshCount, ArenaMesh{});
+    streamOffsets.clear();
+    streamStrides.clear();
+    indexType = VkIndexType::VK_INDEX_TYPE_UINT16;
+    indexSize = 0;
+    vertexSize = 0;
+    if (meshCount == 0)
+    {
+        return true;
+    }
+
+    size_t streamCount = meshes[0]->GetVertexBufferCount();
+    for (size_t j = 0; j < streamCount; ++j)
+    {
+        streamStrides.push_back(GetStreamStride(*meshes[0], j));
+    }
+
+    uint32_t indexCount = 0;
+    uint32_t vertexCount = 0;
+    for (size_t i = 0; i < meshCount; ++i)
+    {
+        const TTH::D3DMesh &mesh = *meshes[i];
+        if (mesh.GetVertexBufferCount() != streamCount)
+        {
+            return false;
+        }
+        for (size_t j = 0; j < streamCount; ++j)
+        {
+            if (GetStreamStride(mesh, j) != streamStrides[j])
+            {
+                return false;
+            }
+        }
+
+        TTH::D3DMesh::GFXPlatformFormat indexFormat;
+        mesh.GetIndices(indexFormat, 0, 0);
+        if (indexFormat == TTH::D3DMesh::GFXPlatformFormat::eGFXPlatformFormat_U32)
+        {
+            indexType = VkIndexType::VK_INDEX_TYPE_UINT32;
+        }
+
+        ArenaMesh &arenaMesh = this->meshes[i];
+        arenaMesh.firstIndex = indexCount;
+        arenaMesh.vertexOffset = static_cast<int32_t>(vertexCount);
+        arenaMesh.indexCount = static_cast<uint32_t>(mesh.GetIndexCount());
+        arenaMesh.vertexCount = static_cast<uint32_t>(mesh.GetVertexCount());
+        indexCount += arenaMesh.indexCount;
+        vertexCount += arenaMesh.vertexCount;
+    }
+
+    indexSize = AlignArena(VkDeviceSize(indexCount) * (indexType == VkIndexType::VK_INDEX_TYPE_UINT32 ? 4 : 2));
+    for (size_t j = 0; j < streamCount; ++j)
+    {
+        streamOffsets.push_back(vertexSize);
+        vertexSize = AlignArena(vertexSize + VkDeviceSize(vertexCount) * streamStrides[j]);
+    }
+    return true;
+}
+
+VkResult GeometryArena::Upload(VkDevice device, const TTH::D3DMesh *const *meshes, UploadManager &uploads, VkBuffer indexBuffer, VkBuffer vertexBuffer) const
+{
+    VkResult err;
+    uint32_t indexStride = indexType == VkIndexType::VK_INDEX_TYPE_UINT32 ? 4 : 2;
+    for (size_t i = 0; i < this->meshes.size(); ++i)
+    {
+        const ArenaMesh &arenaMesh = this->meshes[i];
+        TTH::D3DMesh::GFXPlatformFormat indexFormat;
+        const void *indices = meshes[i]->GetIndices(indexFormat, 0, 0);
+        if (indexType == VkIndexType::VK_INDEX_TYPE_UINT16 || indexFormat == TTH::D3DMesh::GFXPlatformFormat::eGFXPlatformFormat_U32)
+        {
+            err = uploads.Upload(device, indexBuffer, VkDeviceSize(arenaMesh.firstIndex) * indexStride, indices, VkDeviceSize(arenaMesh.indexCount) * indexStride);
+        }
+        else
+        {
+            // Widened straight into the staging ring, a piece at a time so no piece outgrows it
+            const uint16_t *narrow = static_cast<const uint16_t *>(indices);
+            uint32_t pieceCount = static_cast<uint32_t>(std::max<VkDeviceSize>(uploads.capacity / 8, 1));
+            err = VkResult::VK_SUCCESS;
+            for (uint32_t first = 0; first < arenaMesh.indexCount && err == VkResult::VK_SUCCESS; first += pieceCount)
+            {
+                uint32_t count = std::min(pieceCount, arenaMesh.indexCount - first);
+                void *out;
+                err = uploads.Stage(device, indexBuffer, VkDeviceSize(arenaMesh.firstIndex + first) * 4, VkDeviceSize(count) * 4, out);
+                if (err == VkResult::VK_SUCCESS)
+                {
+                    std::copy(narrow + first, narrow + first + count, static_cast<uint32_t *>(out));
+                }
+            }
+        }
+        if (err != VkResult::VK_SUCCESS)
+        {
+            return err;
+        }
+
+        for (size_t j = 0; j < streamOffsets.size(); ++j)
+        {
+            TTH::D3DMesh::AttributeDescription attributes[32];
+            const void *vertexData = meshes[i]->GetVertexBuffer(j, 0, 0, attributes);
+            VkDeviceSize streamSize = VkDeviceSize(arenaMesh.vertexCount) * streamStrides[j];
+            err = uploads.Upload(device, vertexBuffer, streamOffsets[j] + VkDeviceSize(arenaMesh.vertexOffset) * streamStrides[j], vertexData,
+                                 std::min<VkDeviceSize>(streamSize, meshes[i]->GetVertexBufferSize(j)));
+            if (err != VkResult::VK_SUCCESS)
+            {
+                return err;
+            }
+        }
+    }
+    return VkResult::VK_SUCCESS;
+}
@@ -0,0 +1,214 @@
+#include <algorithm>
+#include <ttc/render/pose.hpp>
+#include <unordered_map>
+
+void BoneBinding::Build(const uint64_t *boneCRC64, size_t boneCount, const uint64_t *trackCRC64, size_t trackCount)
+{
+    std::unordered_map<uint64_t, int32_t> trackLookup;
+    trackLookup.reserve(trackCount);
+    for (size_t i = 0; i < trackCount; ++i)
+    {
+        trackLookup.emplace(trackCRC64[i], static_cast<int32_t>(i));
+    }
+
+    trackIndices.resize(boneCount);
+    for (size_t i = 0; i < boneCount; ++i)
+    {
+        auto it = trackLookup.find(boneCRC64[i]);
+        trackIndices[i] = it == trackLookup.end() ? UNANIMATED : it->second;
+    }
+}
+
+void BoneBinding::Build(const uint64_t *boneCRC64, size_t boneCount, const AnimationTracks &tracks)
+{
+    Build(boneCRC64, boneCount, tracks.boneCRC64.data(), tracks.GetTrackCount());
+}
+
+void BoneBinding::Build(const TTH::Skeleton &skeleton, const AnimationTracks &tracks)
+{
+    std::vector<uint64_t> boneCRC64(skeleton.GetBoneCount());
+    for (size_t i = 0; i < boneCRC64.size(); ++i)
+    {
+        boneCRC64[i] = skeleton.GetBoneCRC64(i);
+    }
+    Build(boneCRC64.data(), boneCRC64.size(), tracks);
+}
+
+size_t SkeletonHierarchy::GetMaxLevelSize() const
+{
+    size_t size = 0;
+    for (size_t i = 0; i < GetLevelCount(); ++i)
+    {
+        size = std::max<size_t>(size, levelOffsets[i + 1] - levelOffsets[i]);
+    }
+    return size;
+}
+
+void SkeletonHierarchy::Clear()
+{
+    skeletonBoneCount = 0;
+    skeletonIndices.clear();
+    parents.clear();
+    boneCRC64.clear();
+    levelOffsets.clear();
+    restPose.Resize(0);
+}
+
+TTH::errno_t SkeletonHierarchy::Build(const TTH::Skeleton &skeleton)
+{
+    static constexpr uint32_t UNKNOWN_DEPTH = UINT32_MAX;
+
+    Clear();
+    size_t boneCount = skeleton.GetBoneCount();
+    skeletonBoneCount = boneCount;
+    if (boneCount == 0)
+    {
+        return 0;
+    }
+
+    std::vector<uint32_t> depths(boneCount, UNKNOWN_DEPTH);
+    std::vector<uint32_t> chain;
+    uint32_t maxDepth = 0;
+    for (size_t i = 0; i < boneCount; ++i)
+    {
+        // Walk up until a bone of known depth or a root, a chain longer than the skeleton can only be a cycle
+        size_t bone = i;
+        uint32_t depth = 0;
+        chain.clear();
+        while (depths[bone] == UNKNOWN_DEPTH)
+        {
+            if (chain.size() >= boneCount)
+            {
+                return -EINVAL;
+            }
+            chain.push_back(static_cast<uint32_t>(bone));
+            int32_t parent = skeleton.GetBoneParentIndex(bone);
+            if (parent < 0)
+            {
+                break;
+            }
+            if (static_cast<size_t>(parent) >= boneCount)
+            {
+                return -EINVAL;
+            }
+            bone = parent;
+        }
+        if (depths[bone] != UNKNOWN_DEPTH)
+        {
+            depth = depths[bone] + 1;
+        }
+        for (auto it = chain.rbegin(); it != chain.rend(); ++it)
+        {
+            depths[*it] = depth++;
+        }
+        maxDepth = std::max(maxDepth, depths[i]);
+    }
+
+    // Stable counting sort by depth, bones of one level keep their skeleton order
+    levelOffsets.assign(maxDepth + 2, 0);
+    for (size_t i = 0; i < boneCount; ++i)
+    {
+        ++levelOffsets[depths[i] + 1];
+    }
+    for (size_t i = 1; i < levelOffsets.size(); ++i)
+    {
+        levelOffsets[i] += levelOffsets[i - 1];
+    }
+    std::vector<uint32_t> cursors(levelOffsets.begin(), levelOffsets.end() - 1);
+    std::vector<uint32_t> flatIndices(boneCount);
+    skeletonIndices.resize(boneCount);
+    for (size_t i = 0; i < boneCount; ++i)
+    {
+        flatIndices[i] = cursors[depths[i]]++;
+        skeletonIndices[flatIndices[i]] = static_cast<uint32_t>(i);
+    }
+
+    parents.resize(boneCount);
+    boneCRC64.resize(boneCount);
+    restPose.Resize(boneCount);
+    for (size_t i = 0; i < boneCount; ++i)
+    {
+        uint32_t bone = skeletonIndices[i];
+        int32_t parent = skeleton.GetBoneParentIndex(bone);
+        parents[i] = parent < 0 ? -1 : static_cast<int32_t>(flatIndices[parent]);
+        boneCRC64[i] = skeleton.GetBoneCRC64(bone);
+        const TTH::Vector3 *localPos = skeleton.GetBoneLocalPosition(bone);
+        const TTH::Quaternion *localRot = skeleton.GetBoneLocalRotation(bone);
+        restPose.Set(i, glm::vec3{localPos->x, localPos->y, localPos->z}, glm::quat{localRot->w, localRot->x, localRot->y, localRot->z});
+    }
+    return 0;
+}
+
+void SkeletonHierarchy::ComposeGlobals(glm::mat4 *transforms, glm::mat4 *scratch) const
+{
+    ::ComposeGlobals(parents.data(), levelOffsets.data(), GetLevelCount(), transforms, scratch);
+}
+
+void SkeletonHierarchy::Subset(const std::vector<bool> &keep, SkeletonHierarchy &out) const
+{
+    // Parents come before their children, so walking backwards pulls in whole ancestor chains
+    std::vector<bool> kept = keep;
+    for (size_t i = GetBoneCount(); i-- > 0;)
+    {
+        if (kept[i] && parents[i] >= 0)
+        {
+            kept[parents[i]] = true;
+        }
+    }
+
+    out.Clear();
+    out.skeletonBoneCount = skeletonBoneCount;
+    out.levelOffsets.assign(levelOffsets.size(), 0);
+    std::vector<int32_t> subsetIndices(GetBoneCount(), -1);
+    size_t count = 0;
+    for (size_t level = 0; level < GetLevelCount(); ++level)
+    {
+        for (uint32_t i = levelOffsets[level]; i < levelOffsets[level + 1]; ++i)
+        {
+            if (kept[i])
+            {
+                subsetIndices[i] = static_cast<int32_t>(count++);
+            }
+        }
+        out.levelOffsets[level + 1] = static_cast<uint32_t>(count);
+    }
+    // Levels deeper than every kept bone would be empty
+    while (out.levelOffsets.size() > 1 && out.levelOffsets[out.levelOffsets.size() - 2] == count)
+    {
+        out.levelOffsets.pop_back();
+    }
+
+    out.skeletonIndices.resize(count);
+    out.parents.resize(count);
+    out.boneCRC64.resize(count);
+    out.restPose.Resize(count);
+    for (size_t i = 0; i < GetBoneCount(); ++i)
+    {
+        int32_t index = subsetIndices[i];
+        if (index < 0)
+        {
+            continue;
+        }
+        out.skeletonIndices[index] = skeletonIndices[i];
+        out.parents[index] = parents[i] < 0 ? -1 : subsetIndices[parents[i]];
+        out.boneCRC64[index] = boneCRC64[i];
+        out.restPose.Set(index, glm::vec3{restPose.tx[i], restPose.ty[i], restPose.tz[i]}, glm::quat{restPose.qw[i], restPose.qx[i], restPose.qy[i], restPose.qz[i]});
+    }
+}
+
+void ApplySampledPose(const SkeletonHierarchy &hierarchy, const BoneBinding &binding, const AnimationTracks &tracks, const glm::vec3 *sampledTranslations,
+                      const glm::quat *sampledRotations, LocalPose &pose)
+{
+    const LocalPose &restPose = hierarchy.restPose;
+    for (size_t i = 0; i < hierarchy.GetBoneCount(); ++i)
+    {
+        int32_t track = binding.trackIndices[i];
+        if (track == BoneBinding::UNANIMATED)
+        {
+            continue;
+        }
+        glm::vec3 restTranslation{restPose.tx[i], restPose.ty[i], restPose.tz[i]};
+        glm::vec3 translation = tracks.HasTranslation(track) ? sampledTranslations[track] * glm::length(restTranslation) : restTranslation;
+        pose.Set(i, translation, sampledRotations[track]);
+    }
+}
@@ -0,0 +1,259 @@
+#include <ttc/render/posekernel.hpp>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define TTC_POSE_AVX2 1
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define TTC_POSE_SSE 1
+#endif
+
+void LocalPose::Resize(size_t boneCount)
+{
+    tx.resize(boneCount, 0.0f);
+    ty.resize(boneCount, 0.0f);
+    tz.resize(boneCount, 0.0f);
+    qx.resize(boneCount, 0.0f);
+    qy.resize(boneCount, 0.0f);
+    qz.resize(boneCount, 0.0f);
+    qw.resize(boneCount, 1.0f);
+}
+
+static void BuildLocalMatrix(const LocalPose &pose, size_t bone, float *m)
+{
+    float x = pose.qx[bone], y = pose.qy[bone], z = pose.qz[bone], w = pose.qw[bone];
+    float xx = x * x, yy = y * y, zz = z * z;
+    float xy = x * y, xz = x * z, yz = y * z;
+    float wx = w * x, wy = w * y, wz = w * z;
+
+    m[0] = 1.0f - 2.0f * (yy + zz);
+    m[1] = 2.0f * (xy + wz);
+    m[2] = 2.0f * (xz - wy);
+    m[3] = 0.0f;
+    m[4] = 2.0f * (xy - wz);
+    m[5] = 1.0f - 2.0f * (xx + zz);
+    m[6] = 2.0f * (yz + wx);
+    m[7] = 0.0f;
+    m[8] = 2.0f * (xz + wy);
+    m[9] = 2.0f * (yz - wx);
+    m[10] = 1.0f - 2.0f * (xx + yy);
+    m[11] = 0.0f;
+    m[12] = pose.tx[bone];
+    m[13] = pose.ty[bone];
+    m[14] = pose.tz[bone];
+    m[15] = 1.0f;
+}
+
+#if TTC_POSE_SSE
+static inline __m128 MulAdd(__m128 a, __m128 b, __m128 c)
+{
+#if defined(__FMA__)
+    return _mm_fmadd_ps(a, b, c);
+#else
+    return _mm_add_ps(_mm_mul_ps(a, b), c);
+#endif
+}
+
+// r0..r3 hold rows 0..3 of one matrix column for 4 consecutive bones
+static inline void StoreColumn4(__m128 r0, __m128 r1, __m128 r2, __m128 r3, float *m, size_t column)
+{
+    _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+    _mm_storeu_ps(m + column * 4, r0);
+    _mm_storeu_ps(m + 16 + column * 4, r1);
+    _mm_storeu_ps(m + 32 + column * 4, r2);
+    _mm_storeu_ps(m + 48 + column * 4, r3);
+}
+
+static void BuildLocalMatrices4(const LocalPose &pose, size_t bone, float *m)
+{
+    __m128 x = _mm_loadu_ps(&pose.qx[bone]), y = _mm_loadu_ps(&pose.qy[bone]), z = _mm_loadu_ps(&pose.qz[bone]), w = _mm_loadu_ps(&pose.qw[bone]);
+    __m128 one = _mm_set1_ps(1.0f), two = _mm_set1_ps(2.0f), zero = _mm_setzero_ps();
+    __m128 x2 = _mm_mul_ps(x, two), y2 = _mm_mul_ps(y, two), z2 = _mm_mul_ps(z, two);
+    __m128 xx = _mm_mul_ps(x, x2), yy = _mm_mul_ps(y, y2), zz = _mm_mul_ps(z, z2);
+    __m128 xy = _mm_mul_ps(x, y2), xz = _mm_mul_ps(x, z2), yz = _mm_mul_ps(y, z2);
+    __m128 wx = _mm_mul_ps(w, x2), wy = _mm_mul_ps(w, y2), wz = _mm_mul_ps(w, z2);
+
+    StoreColumn4(_mm_sub_ps(one, _mm_add_ps(yy, zz)), _mm_add_ps(xy, wz), _mm_sub_ps(xz, wy), zero, m, 0);
+    StoreColumn4(_mm_sub_ps(xy, wz), _mm_sub_ps(one, _mm_add_ps(xx, zz)), _mm_add_ps(yz, wx), zero, m, 1);
+    StoreColumn4(_mm_add_ps(xz, wy), _mm_sub_ps(yz, wx), _mm_sub_ps(one, _mm_add_ps(xx, yy)), zero, m, 2);
+    StoreColumn4(_mm_loadu_ps(&pose.tx[bone]), _mm_loadu_ps(&pose.ty[bone]), _mm_loadu_ps(&pose.tz[bone]), one, m, 3);
+}
+
+// Every column of the product is a 4-wide vector already, so one bone is one pass of 16 multiply-adds
+static inline void MultiplyMatrix(const float *a, const float *b, float *out)
+{
+    __m128 a0 = _mm_loadu_ps(a), a1 = _mm_loadu_ps(a + 4), a2 = _mm_loadu_ps(a + 8), a3 = _mm_loadu_ps(a + 12);
+    __m128 r[4];
+    for (size_t j = 0; j < 4; ++j)
+    {
+        r[j] = _mm_mul_ps(a0, _mm_set1_ps(b[j * 4]));
+        r[j] = MulAdd(a1, _mm_set1_ps(b[j * 4 + 1]), r[j]);
+        r[j] = MulAdd(a2, _mm_set1_ps(b[j * 4 + 2]), r[j]);
+        r[j] = MulAdd(a3, _mm_set1_ps(b[j * 4 + 3]), r[j]);
+    }
+    for (size_t j = 0; j < 4; ++j)
+    {
+        _mm_storeu_ps(out + j * 4, r[j]);
+    }
+}
+#else
+static inline void MultiplyMatrix(const float *a, const float *b, float *out)
+{
+    float r[16];
+    for (size_t j = 0; j < 4; ++j)
+    {
+        for (size_t i = 0; i < 4; ++i)
+        {
+            r[j * 4 + i] = a[i] * b[j * 4] + a[4 + i] * b[j * 4 + 1] + a[8 + i] * b[j * 4 + 2] + a[12 + i] * b[j * 4 + 3];
+        }
+    }
+    for (size_t i = 0; i < 16; ++i)
+    {
+        out[i] = r[i];
+    }
+}
+#endif
+
+#if TTC_POSE_AVX2
+static inline __m256 MulAdd8(__m256 a, __m256 b, __m256 c)
+{
+#if defined(__FMA__)
+    return _mm256_fmadd_ps(a, b, c);
+#else
+    return _mm256_add_ps(_mm256_mul_ps(a, b), c);
+#endif
+}
+
+// Same as StoreColumn4, the low lane holds bones 0-3 and the high lane bones 4-7
+static inline void StoreColumn8(__m256 r0, __m256 r1, __m256 r2, __m256 r3, float *m, size_t column)
+{
+    __m256 t0 = _mm256_unpacklo_ps(r0, r1), t1 = _mm256_unpackhi_ps(r0, r1), t2 = _mm256_unpacklo_ps(r2, r3), t3 = _mm256_unpackhi_ps(r2, r3);
+    __m256 c[4] = {_mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0)), _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2)), _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0)),
+                   _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2))};
+    for (size_t i = 0; i < 4; ++i)
+    {
+        _mm_storeu_ps(m + i * 16 + column * 4, _mm256_castps256_ps128(c[i]));
+        _mm_storeu_ps(m + (i + 4) * 16 + column * 4, _mm256_extractf128_ps(c[i], 1));
+    }
+}
+
+static void BuildLocalMatrices8(const LocalPose &pose, size_t bone, float *m)
+{
+    __m256 x = _mm256_loadu_ps(&pose.qx[bone]), y = _mm256_loadu_ps(&pose.qy[bone]), z = _mm256_loadu_ps(&pose.qz[bone]), w = _mm256_loadu_ps(&pose.qw[bone]);
+    __m256 one = _mm256_set1_ps(1.0f), two = _mm256_set1_ps(2.0f), zero = _mm256_setzero_ps();
+    __m256 x2 = _mm256_mul_ps(x, two), y2 = _mm256_mul_ps(y, two), z2 = _mm256_mul_ps(z, two);
+    __m256 xx = _mm256_mul_ps(x, x2), yy = _mm256_mul_ps(y, y2), zz = _mm256_mul_ps(z, z2);
+    __m256 xy = _mm256_mul_ps(x, y2), xz = _mm256_mul_ps(x, z2), yz = _mm256_mul_ps(y, z2);
+    __m256 wx = _mm256_mul_ps(w, x2), wy = _mm256_mul_ps(w, y2), wz = _mm256_mul_ps(w, z2);
+
+    StoreColumn8(_mm256_sub_ps(one, _mm256_add_ps(yy, zz)), _mm256_add_ps(xy, wz), _mm256_sub_ps(xz, wy), zero, m, 0);
+    StoreColumn8(_mm256_sub_ps(xy, wz), _mm256_sub_ps(one, _mm256_add_ps(xx, zz)), _mm256_add_ps(yz, wx), zero, m, 1);
+    StoreColumn8(_mm256_add_ps(xz, wy), _mm256_sub_ps(yz, wx), _mm256_sub_ps(one, _mm256_add_ps(xx, yy)), zero, m, 2);
+    StoreColumn8(_mm256_loadu_ps(&pose.tx[bone]), _mm256_loadu_ps(&pose.ty[bone]), _mm256_loadu_ps(&pose.tz[bone]), one, m, 3);
+}
+
+// Two independent products per pass, one bone per 128-bit lane
+static inline void MultiplyMatrix2(const float *a0, const float *a1, const float *b0, const float *b1, float *out0, float *out1)
+{
+    __m256 a[4];
+    for (size_t i = 0; i < 4; ++i)
+    {
+        a[i] = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(a0 + i * 4)), _mm_loadu_ps(a1 + i * 4), 1);
+    }
+    __m256 r[4];
+    for (size_t j = 0; j < 4; ++j)
+    {
+        r[j] = _mm256_mul_ps(a[0], _mm256_setr_m128(_mm_set1_ps(b0[j * 4]), _mm_set1_ps(b1[j * 4])));
+        r[j] = MulAdd8(a[1], _mm256_setr_m128(_mm_set1_ps(b0[j * 4 + 1]), _mm_set1_ps(b1[j * 4 + 1])), r[j]);
+        r[j] = MulAdd8(a[2], _mm256_setr_m128(_mm_set1_ps(b0[j * 4 + 2]), _mm_set1_ps(b1[j * 4 + 2])), r[j]);
+        r[j] = MulAdd8(a[3], _mm256_setr_m128(_mm_set1_ps(b0[j * 4 + 3]), _mm_set1_ps(b1[j * 4 + 3])), r[j]);
+    }
+    for (size_t j = 0; j < 4; ++j)
+    {
+        _mm_storeu_ps(out0 + j * 4, _mm256_castps256_ps128(r[j]));
+        _mm_storeu_ps(out1 + j * 4, _mm256_extractf128_ps(r[j], 1));
+    }
+}
+#endif
+
+void BuildLocalMatrices(const LocalPose &pose, size_t first, size_t count, glm::mat4 *out)
+{
+    if (count == 0)
+    {
+        return;
+    }
+    float *m = &out[0][0][0];
+    size_t i = 0;
+#if TTC_POSE_AVX2
+    for (; i + 8 <= count; i += 8)
+    {
+        BuildLocalMatrices8(pose, first + i, m + i * 16);
+    }
+#endif
+#if TTC_POSE_SSE
+    for (; i + 4 <= count; i += 4)
+    {
+        BuildLocalMatrices4(pose, first + i, m + i * 16);
+    }
+#endif
+    for (; i < count; ++i)
+    {
+        BuildLocalMatrix(pose, first + i, m + i * 16);
+    }
+}
+
+void MultiplyMatrices(const glm::mat4 *a, const glm::mat4 *b, size_t count, glm::mat4 *out)
+{
+    size_t i = 0;
+#if TTC_POSE_AVX2
+    for (; i + 2 <= count; i += 2)
+    {
+        MultiplyMatrix2(&a[i][0][0], &a[i + 1][0][0], &b[i][0][0], &b[i + 1][0][0], &out[i][0][0], &out[i + 1][0][0]);
+    }
+#endif
+    for (; i < count; ++i)
+    {
+        MultiplyMatrix(&a[i][0][0], &b[i][0][0], &out[i][0][0]);
+    }
+}
+
+void PackAffineRows(const glm::mat4 *m, size_t count, float *out)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        const float *in = &m[i][0][0];
+        float *rows = out + i * 12;
+#if TTC_POSE_SSE
+        __m128 c0 = _mm_loadu_ps(in), c1 = _mm_loadu_ps(in + 4), c2 = _mm_loadu_ps(in + 8), c3 = _mm_loadu_ps(in + 12);
+        _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+        _mm_storeu_ps(rows, c0);
+        _mm_storeu_ps(rows + 4, c1);
+        _mm_storeu_ps(rows + 8, c2);
+#else
+        for (size_t row = 0; row < 3; ++row)
+        {
+            for (size_t column = 0; column < 4; ++column)
+            {
+                rows[row * 4 + column] = in[column * 4 + row];
+            }
+        }
+#endif
+    }
+}
+
+void ComposeGlobals(const int32_t *parents, const uint32_t *levelOffsets, size_t levelCount, glm::mat4 *transforms, glm::mat4 *scratch)
+{
+    // Level 0 only holds roots, every later level gathers its parents and is multiplied as one batch
+    for (size_t level = 1; level < levelCount; ++level)
+    {
+        uint32_t first = levelOffsets[level];
+        uint32_t count = levelOffsets[level + 1] - first;
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            scratch[i] = transforms[parents[first + i]];
+        }
+        MultiplyMatrices(scratch, transforms + first, count, transforms + first);
+    }
+}
@@ -0,0 +1,160 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <new>
+#include <ttc/render/posekernel.hpp>
+#include <ttc/render/posestage.hpp>
+#include <tth/core/log.hpp>
+
+// Per-thread buffers reused across instances and frames
+struct PoseScratch
+{
+    std::vector<glm::vec3> translations;
+    std::vector<glm::quat> rotations;
+    LocalPose pose;
+    std::vector<glm::mat4> globals;
+    std::vector<glm::mat4> compose;
+};
+
+static thread_local PoseScratch scratch;
+
+float PoseInstance::GetClipTime() const
+{
+    float duration = tracks->duration;
+    if (duration <= 0.0f)
+    {
+        return 0.0f;
+    }
+    switch (loopMode)
+    {
+    case LoopMode::LOOP:
+        return time - std::floor(time / duration) * duration;
+    case LoopMode::CLAMP:
+        return std::clamp(time, 0.0f, duration);
+    case LoopMode::PING_PONG:
+    {
+        float phase = time - std::floor(time / (2.0f * duration)) * 2.0f * duration;
+        return phase <= duration ? phase : 2.0f * duration - phase;
+    }
+    }
+    return 0.0f;
+}
+
+uint32_t PoseStage::AddInstance(const SkeletonHierarchy &hierarchy, const AnimationTracks &tracks, const BoneBinding &binding)
+{
+    // The arena holds the whole skeleton even when hierarchy only evaluates part of it, bones left out keep the identity
+    size_t boneCount = hierarchy.skeletonBoneCount;
+    if (arenaSize + boneCount > arenaCapacity)
+    {
+        size_t capacity = std::max(arenaSize + boneCount, arenaCapacity * 2);
+        glm::mat4 *newArena = static_cast<glm::mat4 *>(::operator new(capacity * sizeof(glm::mat4), std::align_val_t(CACHE_LINE_SIZE)));
+        if (arena != nullptr)
+        {
+            memcpy(newArena, arena, arenaSize * sizeof(glm::mat4));
+            ::operator delete(arena, std::align_val_t(CACHE_LINE_SIZE));
+        }
+        arena = newArena;
+        arenaCapacity = capacity;
+    }
+
+    PoseInstance &instance = instances.emplace_back();
+    instance.hierarchy = &hierarchy;
+    instance.tracks = &tracks;
+    instance.binding = &binding;
+    instance.sampler.Reset(tracks, binding.trackIndices.data(), binding.trackIndices.size());
+    instance.poseOffset = arenaSize;
+    arenaSize += boneCount;
+    std::fill_n(arena + instance.poseOffset, boneCount, glm::mat4(1.0f));
+    return static_cast<uint32_t>(instances.size() - 1);
+}
+
+void PoseStage::Clear()
+{
+    instances.clear();
+    if (arena != nullptr)
+    {
+        ::operator delete(arena, std::align_val_t(CACHE_LINE_SIZE));
+    }
+    arena = nullptr;
+    arenaSize = 0;
+    arenaCapacity = 0;
+}
+
+static void EvaluateInstance(PoseInstance &instance, glm::mat4 *out)
+{
+    if (instance.holdPose)
+    {
+        return;
+    }
+    const SkeletonHierarchy &hierarchy = *instance.hierarchy;
+    float clipTime = instance.GetClipTime();
+
+    if (instance.bakedPoses != nullptr)
+    {
+        instance.bakedPoses->Sample(clipTime, hierarchy, scratch.pose);
+    }
+    else
+    {
+        // Constant tracks and tracks without keys of a kind keep their base value
+        scratch.translations = instance.tracks->baseTranslations;
+        scratch.rotations = instance.tracks->baseRotations;
+        if (instance.bakedClip != nullptr)
+        {
+            instance.bakedClip->Sample(clipTime, scratch.translations.data(), scratch.rotations.data());
+        }
+        else if (instance.stream != nullptr)
+        {
+            TTH::errno_t err = instance.stream->Advance(clipTime);
+            if (err < 0)
+            {
+                TTH_LOG_ERROR("Animation stream failed to decode at %f with %d, holding the last pose\n", clipTime, err);
+                instance.holdPose = true;
+                return;
+            }
+            instance.stream->Sample(scratch.translations.data(), scratch.rotations.data());
+        }
+        else
+        {
+            instance.sampler.Sample(*instance.tracks, clipTime, scratch.translations.data(), scratch.rotations.data());
+        }
+
+        scratch.pose = hierarchy.restPose;
+        ApplySampledPose(hierarchy, *instance.binding, *instance.tracks, scratch.translations.data(), scratch.rotations.data(), scratch.pose);
+    }
+    scratch.globals.resize(hierarchy.GetBoneCount());
+    scratch.compose.resize(hierarchy.GetMaxLevelSize());
+    BuildLocalMatrices(scratch.pose, 0, hierarchy.GetBoneCount(), scratch.globals.data());
+    hierarchy.ComposeGlobals(scratch.globals.data(), scratch.compose.data());
+    for (size_t i = 0; i < hierarchy.GetBoneCount(); ++i)
+    {
+        out[hierarchy.skeletonIndices[i]] = scratch.globals[i];
+    }
+}
+
+void PoseStage::Update(float deltaTime, JobSystem *jobSystem)
+{
+    auto evaluate = [this, deltaTime](uint32_t begin, uint32_t end)
+    {
+        for (uint32_t i = begin; i < end; ++i)
+        {
+            PoseInstance &instance = instances[i];
+            instance.time += deltaTime * instance.playRate;
+            // Keep repeating playback within one period so the time does not lose precision over long sessions
+            float period = instance.loopMode == LoopMode::PING_PONG ? 2.0f * instance.tracks->duration : instance.tracks->duration;
+            if (instance.loopMode != LoopMode::CLAMP && period > 0.0f)
+            {
+                instance.time -= std::floor(instance.time / period) * period;
+            }
+            EvaluateInstance(instance, arena + instance.poseOffset);
+        }
+    };
+
+    if (jobSystem != nullptr)
+    {
+        jobSystem->ParallelFor(static_cast<uint32_t>(instances.size()), INSTANCES_PER_JOB, evaluate);
+    }
+    else
+    {
+        evaluate(0, static_cast<uint32_t>(instances.size()));
+    }
+}
@@ -0,0 +1,81 @@
+#include <cstring>
+#include <limits>
+#include <ttc/render/posekernel.hpp>
+#include <ttc/render/skinpalette.hpp>
+
+void SkinPalette::Reset(size_t boneCount, uint32_t slotCount)
+{
+    // NaN never compares equal to a real pose, so the first update computes every bone and every slot gets written in full
+    globals.assign(boneCount, glm::mat4(std::numeric_limits<float>::quiet_NaN()));
+    skinningMatrices.assign(boneCount, glm::mat4(1.0f));
+    changedAt.assign(boneCount, 0);
+    writtenAt.assign(slotCount, 0);
+    ranges.clear();
+    update = 0;
+    skippedBones = 0;
+    skippedUploads = 0;
+    totalBones = 0;
+    totalSkippedBones = 0;
+    totalSkippedUploads = 0;
+}
+
+// Appends bone to the last range when it continues it
+static void AddToRanges(std::vector<BoneRange> &ranges, uint32_t bone)
+{
+    if (!ranges.empty() && ranges.back().first + ranges.back().count == bone)
+    {
+        ++ranges.back().count;
+    }
+    else
+    {
+        ranges.push_back(BoneRange{bone, 1});
+    }
+}
+
+void SkinPalette::Update(const glm::mat4 *newGlobals, const glm::mat4 *inverseBindMatrices)
+{
+    ++update;
+    ranges.clear();
+    for (uint32_t i = 0; i < GetBoneCount(); ++i)
+    {
+        if (std::memcmp(&globals[i], &newGlobals[i], sizeof(glm::mat4)) != 0)
+        {
+            globals[i] = newGlobals[i];
+            changedAt[i] = update;
+            AddToRanges(ranges, i);
+        }
+    }
+
+    uint32_t recomputed = 0;
+    for (const BoneRange &range : ranges)
+    {
+        MultiplyMatrices(globals.data() + range.first, inverseBindMatrices + range.first, range.count, skinningMatrices.data() + range.first);
+        recomputed += range.count;
+    }
+    skippedBones = static_cast<uint32_t>(GetBoneCount()) - recomputed;
+    totalBones += GetBoneCount();
+    totalSkippedBones += skippedBones;
+}
+
+const std::vector<BoneRange> &SkinPalette::Write(uint32_t slot, float *out)
+{
+    ranges.clear();
+    for (uint32_t i = 0; i < GetBoneCount(); ++i)
+    {
+        if (changedAt[i] > writtenAt[slot])
+        {
+            AddToRanges(ranges, i);
+        }
+    }
+
+    uint32_t written = 0;
+    for (const BoneRange &range : ranges)
+    {
+        PackAffineRows(skinningMatrices.data() + range.first, range.count, out + range.first * 12);
+        written += range.count;
+    }
+    writtenAt[slot] = update;
+    skippedUploads = static_cast<uint32_t>(GetBoneCount()) - written;
+    totalSkippedUploads += skippedUploads;
+    return ranges;
+}
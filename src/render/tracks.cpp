@@ -0,0 +1,296 @@
+#include <algorithm>
+#include <cmath>
+#include <ttc/render/tracks.hpp>
+
+glm::quat Nlerp(const glm::quat &a, const glm::quat &b, float t)
+{
+    glm::quat end = glm::dot(a, b) < 0.0f ? -b : b;
+    return glm::normalize(a * (1.0f - t) + end * t);
+}
+
+// Index of the last key at or before time, clamped to the track
+static uint32_t FindKey(const float *times, uint32_t count, float time)
+{
+    const float *it = std::upper_bound(times, times + count, time);
+    return it == times ? 0 : static_cast<uint32_t>(it - times - 1);
+}
+
+static float GetBlend(const float *times, uint32_t key, uint32_t count, float time)
+{
+    if (key + 1 >= count || times[key + 1] <= times[key])
+    {
+        return 0.0f;
+    }
+    return std::clamp((time - times[key]) / (times[key + 1] - times[key]), 0.0f, 1.0f);
+}
+
+static glm::vec3 InterpolateTranslation(const AnimationTracks &tracks, size_t track, uint32_t key, float time)
+{
+    uint32_t count = tracks.translationOffsets[track + 1] - tracks.translationOffsets[track];
+    const float *times = tracks.translationTimes.data() + tracks.translationOffsets[track];
+    const glm::vec3 *values = tracks.translations.data() + tracks.translationOffsets[track];
+    float t = GetBlend(times, key, count, time);
+    return t > 0.0f ? glm::mix(values[key], values[key + 1], t) : values[key];
+}
+
+static glm::quat InterpolateRotation(const AnimationTracks &tracks, size_t track, uint32_t key, float time)
+{
+    uint32_t count = tracks.rotationOffsets[track + 1] - tracks.rotationOffsets[track];
+    const float *times = tracks.rotationTimes.data() + tracks.rotationOffsets[track];
+    const glm::quat *values = tracks.rotations.data() + tracks.rotationOffsets[track];
+    float t = GetBlend(times, key, count, time);
+    return t > 0.0f ? Nlerp(values[key], values[key + 1], t) : values[key];
+}
+
+void AnimationTracks::Sample(float time, glm::vec3 *outTranslations, glm::quat *outRotations) const
+{
+    for (uint32_t i : animatedTranslationTracks)
+    {
+        uint32_t key = FindKey(translationTimes.data() + translationOffsets[i], translationOffsets[i + 1] - translationOffsets[i], time);
+        outTranslations[i] = InterpolateTranslation(*this, i, key, time);
+    }
+    for (uint32_t i : animatedRotationTracks)
+    {
+        uint32_t key = FindKey(rotationTimes.data() + rotationOffsets[i], rotationOffsets[i + 1] - rotationOffsets[i], time);
+        outRotations[i] = InterpolateRotation(*this, i, key, time);
+    }
+}
+
+void AnimationTracks::FindAnimatedTracks()
+{
+    baseTranslations.assign(GetTrackCount(), glm::vec3(0.0f));
+    baseRotations.assign(GetTrackCount(), glm::quat(1.0f, 0.0f, 0.0f, 0.0f));
+    animatedTranslationTracks.clear();
+    animatedRotationTracks.clear();
+    for (uint32_t i = 0; i < GetTrackCount(); ++i)
+    {
+        uint32_t translationCount = translationOffsets[i + 1] - translationOffsets[i];
+        if (translationCount == 1)
+        {
+            baseTranslations[i] = translations[translationOffsets[i]];
+        }
+        else if (translationCount > 1)
+        {
+            animatedTranslationTracks.push_back(i);
+        }
+
+        uint32_t rotationCount = rotationOffsets[i + 1] - rotationOffsets[i];
+        if (rotationCount == 1)
+        {
+            baseRotations[i] = rotations[rotationOffsets[i]];
+        }
+        else if (rotationCount > 1)
+        {
+            animatedRotationTracks.push_back(i);
+        }
+    }
+}
+
+void AnimationTracks::Clear()
+{
+    duration = 0.0f;
+    boneCRC64.clear();
+    translationOffsets.clear();
+    translationTimes.clear();
+    translations.clear();
+    rotationOffsets.clear();
+    rotationTimes.clear();
+    rotations.clear();
+    baseTranslations.clear();
+    baseRotations.clear();
+    animatedTranslationTracks.clear();
+    animatedRotationTracks.clear();
+}
+
+// Moves cursor to the last key at or before time. Small forward steps are walked, anything else is a binary search.
+static uint32_t AdvanceCursor(const float *times, uint32_t count, uint32_t cursor, float time, bool forward)
+{
+    if (forward && cursor < count)
+    {
+        for (uint32_t steps = 0; steps < TrackSampler::MAX_LINEAR_STEPS; ++steps)
+        {
+            if (cursor + 1 >= count || times[cursor + 1] > time)
+            {
+                return cursor;
+            }
+            ++cursor;
+        }
+    }
+    return FindKey(times, count, time);
+}
+
+void TrackSampler::Reset(const AnimationTracks &tracks)
+{
+    translationCursors.assign(tracks.GetTrackCount(), 0);
+    rotationCursors.assign(tracks.GetTrackCount(), 0);
+    translationTracks = tracks.animatedTranslationTracks;
+    rotationTracks = tracks.animatedRotationTracks;
+    lastTime = 0.0f;
+}
+
+void TrackSampler::Reset(const AnimationTracks &tracks, const int32_t *boundTracks, size_t boundCount)
+{
+    Reset(tracks);
+    std::vector<bool> bound(tracks.GetTrackCount(), false);
+    for (size_t i = 0; i < boundCount; ++i)
+    {
+        if (boundTracks[i] >= 0)
+        {
+            bound[boundTracks[i]] = true;
+        }
+    }
+    std::erase_if(translationTracks, [&bound](uint32_t track) { return !bound[track]; });
+    std::erase_if(rotationTracks, [&bound](uint32_t track) { return !bound[track]; });
+}
+
+void TrackSampler::Sample(const AnimationTracks &tracks, float time, glm::vec3 *outTranslations, glm::quat *outRotations)
+{
+    if (translationCursors.size() != tracks.GetTrackCount())
+    {
+        Reset(tracks);
+    }
+
+    bool forward = time >= lastTime;
+    for (uint32_t i : translationTracks)
+    {
+        translationCursors[i] = AdvanceCursor(tracks.translationTimes.data() + tracks.translationOffsets[i], tracks.translationOffsets[i + 1] - tracks.translationOffsets[i],
+                                              translationCursors[i], time, forward);
+        outTranslations[i] = InterpolateTranslation(tracks, i, translationCursors[i], time);
+    }
+    for (uint32_t i : rotationTracks)
+    {
+        rotationCursors[i] =
+            AdvanceCursor(tracks.rotationTimes.data() + tracks.rotationOffsets[i], tracks.rotationOffsets[i + 1] - tracks.rotationOffsets[i], rotationCursors[i], time, forward);
+        outRotations[i] = InterpolateRotation(tracks, i, rotationCursors[i], time);
+    }
+    lastTime = time;
+}
+
+void BuildTracks(TTH::Animation &animation, AnimationTracks &tracks)
+{
+    size_t boneCount = animation.GetBoneCount();
+    TTH::KeyframedValue<TTH::Quaternion> *keyRotations = new TTH::KeyframedValue<TTH::Quaternion>[boneCount];
+    TTH::KeyframedValue<TTH::Vector3> *keyTranslations = new TTH::KeyframedValue<TTH::Vector3>[boneCount];
+    animation.GetKeyframes(keyTranslations, keyRotations);
+
+    tracks.Clear();
+    tracks.duration = animation.GetDuration();
+    tracks.boneCRC64.resize(boneCount);
+    tracks.translationOffsets.resize(boneCount + 1);
+    tracks.rotationOffsets.resize(boneCount + 1);
+
+    const TTH::Symbol *boneNames = animation.GetBonesCRC64();
+    tracks.translationOffsets[0] = 0;
+    tracks.rotationOffsets[0] = 0;
+    for (size_t i = 0; i < boneCount; ++i)
+    {
+        tracks.boneCRC64[i] = boneNames[i].mCrc64;
+        tracks.translationOffsets[i + 1] = tracks.translationOffsets[i] + keyTranslations[i].mSamples.size();
+        tracks.rotationOffsets[i + 1] = tracks.rotationOffsets[i] + keyRotations[i].mSamples.size();
+    }
+
+    tracks.translationTimes.reserve(tracks.translationOffsets.back());
+    tracks.translations.reserve(tracks.translationOffsets.back());
+    tracks.rotationTimes.reserve(tracks.rotationOffsets.back());
+    tracks.rotations.reserve(tracks.rotationOffsets.back());
+    for (size_t i = 0; i < boneCount; ++i)
+    {
+        for (const auto &element : keyTranslations[i].mSamples)
+        {
+            tracks.translationTimes.push_back(element.mTime);
+            tracks.translations.push_back(glm::vec3{element.mValue.x, element.mValue.y, element.mValue.z});
+        }
+        for (const auto &element : keyRotations[i].mSamples)
+        {
+            tracks.rotationTimes.push_back(element.mTime);
+            tracks.rotations.push_back(glm::quat{element.mValue.w, element.mValue.x, element.mValue.y, element.mValue.z});
+        }
+    }
+
+    delete[] keyRotations;
+    delete[] keyTranslations;
+    tracks.FindAnimatedTracks();
+}
+
+static bool IsConstant(const glm::vec3 *values, uint32_t count, float tolerance)
+{
+    for (uint32_t i = 1; i < count; ++i)
+    {
+        for (int c = 0; c < 3; ++c)
+        {
+            if (std::abs(values[i][c] - values[0][c]) > tolerance)
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static bool IsConstant(const glm::quat *values, uint32_t count, float tolerance)
+{
+    for (uint32_t i = 1; i < count; ++i)
+    {
+        glm::quat value = glm::dot(values[0], values[i]) < 0.0f ? -values[i] : values[i];
+        for (int c = 0; c < 4; ++c)
+        {
+            if (std::abs(value[c] - values[0][c]) > tolerance)
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Drops every key after the first of the tracks marked in fold and closes the gaps
+template <typename T> static void FoldKeys(std::vector<uint32_t> &offsets, std::vector<float> &times, std::vector<T> &values, const std::vector<bool> &fold)
+{
+    if (offsets.empty())
+    {
+        return;
+    }
+    uint32_t write = 0;
+    uint32_t begin = offsets[0];
+    for (size_t track = 0; track + 1 < offsets.size(); ++track)
+    {
+        uint32_t end = fold[track] ? begin + 1 : offsets[track + 1];
+        for (uint32_t i = begin; i < end; ++i, ++write)
+        {
+            times[write] = times[i];
+            values[write] = values[i];
+        }
+        begin = offsets[track + 1];
+        offsets[track + 1] = write;
+    }
+    times.resize(write);
+    values.resize(write);
+}
+
+TrackFoldStats FoldConstantTracks(AnimationTracks &tracks, float tolerance)
+{
+    TrackFoldStats stats;
+    stats.animatedBefore = tracks.animatedTranslationTracks.size() + tracks.animatedRotationTracks.size();
+
+    std::vector<bool> foldTranslation(tracks.GetTrackCount(), false);
+    std::vector<bool> foldRotation(tracks.GetTrackCount(), false);
+    for (size_t i = 0; i < tracks.GetTrackCount(); ++i)
+    {
+        stats.keyedTracks += tracks.HasTranslation(i) + tracks.HasRotation(i);
+    }
+    for (uint32_t i : tracks.animatedTranslationTracks)
+    {
+        foldTranslation[i] = IsConstant(tracks.translations.data() + tracks.translationOffsets[i], tracks.translationOffsets[i + 1] - tracks.translationOffsets[i], tolerance);
+    }
+    for (uint32_t i : tracks.animatedRotationTracks)
+    {
+        foldRotation[i] = IsConstant(tracks.rotations.data() + tracks.rotationOffsets[i], tracks.rotationOffsets[i + 1] - tracks.rotationOffsets[i], tolerance);
+    }
+
+    FoldKeys(tracks.translationOffsets, tracks.translationTimes, tracks.translations, foldTranslation);
+    FoldKeys(tracks.rotationOffsets, tracks.rotationTimes, tracks.rotations, foldRotation);
+    tracks.FindAnimatedTracks();
+
+    stats.animatedAfter = tracks.animatedTranslationTracks.size() + tracks.animatedRotationTracks.size();
+    return stats;
+}
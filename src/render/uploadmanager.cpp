@@ -0,0 +1,286 @@
+#include <algorithm>
+#include <cstring>
+#include <ttc/render/uploadmanager.hpp>
+
+// Staged data starts on this boundary, copy regions have no alignment requirement but it keeps every source offset friendly to the DMA engines
+constexpr VkDeviceSize UPLOAD_ALIGNMENT = 16;
+
+static VkDeviceSize AlignUpload(VkDeviceSize value, VkDeviceSize alignment) { return alignment > 1 ? (value + alignment - 1) / alignment * alignment : value; }
+
+VkResult UploadManager::Init(VkDevice device, DeviceAllocator &allocator, VkQueue queue, VkCommandPool commandPool, VkDeviceSize capacity)
+{
+    nonCoherentAtomSize = allocator.nonCoherentAtomSize;
+    this->capacity = AlignUpload(capacity, 256);
+    this->queue = queue;
+    this->commandPool = commandPool;
+
+    VkBufferCreateInfo bufferInfo{
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size = this->capacity,
+        .usage = VkBufferUsageFlagBits::VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+    };
+    VkResult err = vkCreateBuffer(device, &bufferInfo, nullptr, &buffer);
+    if (err != VkResult::VK_SUCCESS)
+    {
+        return err;
+    }
+
+    // Plain host memory, the device only reads each byte once so there is no point spending the small device local host visible heap on it
+    err = allocator.AllocateBuffer(device, buffer, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, MemoryCategory::Staging, allocation);
+    if (err != VkResult::VK_SUCCESS)
+    {
+        err = allocator.AllocateBuffer(device, buffer, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, MemoryCategory::Staging, allocation);
+    }
+    if (err != VkResult::VK_SUCCESS)
+    {
+        return err;
+    }
+    coherent = allocator.memProperties.memoryTypes[allocation.memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    mapped = allocation.mapped;
+    return VkResult::VK_SUCCESS;
+}
+
+void UploadManager::Destroy(VkDevice device, DeviceAllocator &allocator)
+{
+    Wait(device, submitted);
+    for (const Batch &batch : inFlight)
+    {
+        idle.push_back(batch);
+    }
+    inFlight.clear();
+    for (const Batch &batch : idle)
+    {
+        vkFreeCommandBuffers(device, commandPool, 1, &batch.commandBuffer);
+        vkDestroyFence(device, batch.fence, nullptr);
+    }
+    idle.clear();
+    copies.clear();
+    vkDestroyBuffer(device, buffer, nullptr);
+    allocator.Free(device, allocation);
+    buffer = VK_NULL_HANDLE;
+    mapped = nullptr;
+}
+
+VkResult UploadManager::Stage(VkDevice device, VkBuffer dst, VkDeviceSize dstOffset, VkDeviceSize size, void *&out)
+{
+    if (size == 0 || size > capacity)
+    {
+        return VkResult::VK_ERROR_OUT_OF_DEVICE_MEMORY;
+    }
+
+    // A staged range never wraps around the end of the ring, whatever is left before the end is skipped
+    VkDeviceSize begin = AlignUpload(head, UPLOAD_ALIGNMENT);
+    if (begin % capacity + size > capacity)
+    {
+        begin += capacity - begin % capacity;
+    }
+    while (begin + size > tail + capacity)
+    {
+        if (tail == head)
+        {
+            // Nothing queued or in flight, the ring is free as a whole
+            tail = begin;
+            batchBegin = begin;
+            break;
+        }
+        VkResult err;
+        if (inFlight.empty())
+        {
+            UploadTicket ticket;
+            err = Submit(device, ticket);
+            if (err != VkResult::VK_SUCCESS)
+            {
+                return err;
+            }
+        }
+        err = RetireOldest(device, true);
+        if (err != VkResult::VK_SUCCESS)
+        {
+            return err;
+        }
+        ++stallCount;
+    }
+
+    head = begin + size;
+    copies.push_back(Copy{dst, VkBufferCopy{begin % capacity, dstOffset, size}});
+    uploadedBytes += size;
+    out = mapped + begin % capacity;
+    return VkResult::VK_SUCCESS;
+}
+
+VkResult UploadManager::Upload(VkDevice device, VkBuffer dst, VkDeviceSize dstOffset, const void *data, VkDeviceSize size)
+{
+    const uint8_t *bytes = static_cast<const uint8_t *>(data);
+    // Pieces of half the ring let the next one be written while the previous batch is still copying
+    VkDeviceSize pieceSize = std::max<VkDeviceSize>(capacity / 2, UPLOAD_ALIGNMENT);
+    for (VkDeviceSize offset = 0; offset < size; offset += pieceSize)
+    {
+        VkDeviceSize count = std::min(pieceSize, size - offset);
+        void *out;
+        VkResult err = Stage(device, dst, dstOffset + offset, count, out);
+        if (err != VkResult::VK_SUCCESS)
+        {
+            return err;
+        }
+        memcpy(out, bytes + offset, count);
+    }
+    return VkResult::VK_SUCCESS;
+}
+
+VkResult UploadManager::Submit(VkDevice device, UploadTicket &ticket)
+{
+    ticket = submitted;
+    if (copies.empty())
+    {
+        return VkResult::VK_SUCCESS;
+    }
+
+    VkResult err;
+    if (!coherent)
+    {
+        // At most two ranges, the queued data can wrap once
+        VkMappedMemoryRange ranges[2];
+        uint32_t rangeCount = 0;
+        for (VkDeviceSize position = batchBegin; position < head;)
+        {
+            VkDeviceSize offset = position % capacity;
+            VkDeviceSize count = std::min(head - position, capacity - offset);
+            VkDeviceSize begin = offset / nonCoherentAtomSize * nonCoherentAtomSize;
+            ranges[rangeCount] = VkMappedMemoryRange{};
+            ranges[rangeCount].sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+            ranges[rangeCount].memory = allocation.memory;
+            ranges[rangeCount].offset = allocation.offset + begin;
+            ranges[rangeCount].size = std::min(AlignUpload(offset + count, nonCoherentAtomSize), capacity) - begin;
+            ++rangeCount;
+            position += count;
+        }
+        err = vkFlushMappedMemoryRanges(device, rangeCount, ranges);
+        if (err != VkResult::VK_SUCCESS)
+        {
+            return err;
+        }
+    }
+
+    Batch batch;
+    if (!idle.empty())
+    {
+        batch = idle.back();
+        idle.pop_back();
+        err = vkResetCommandBuffer(batch.commandBuffer, 0);
+        if (err == VkResult::VK_SUCCESS)
+        {
+            err = vkResetFences(device, 1, &batch.fence);
+        }
+    }
+    else
+    {
+        VkCommandBufferAllocateInfo commandBufferAllocInfo{
+            .sType = VkStructureType::VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+            .commandPool = commandPool,
+            .level = VkCommandBufferLevel::VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+            .commandBufferCount = 1,
+        };
+        err = vkAllocateCommandBuffers(device, &commandBufferAllocInfo, &batch.commandBuffer);
+        if (err == VkResult::VK_SUCCESS)
+        {
+            VkFenceCreateInfo fenceInfo{};
+            fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+            err = vkCreateFence(device, &fenceInfo, nullptr, &batch.fence);
+        }
+    }
+    if (err != VkResult::VK_SUCCESS)
+    {
+        return err;
+    }
+
+    VkCommandBufferBeginInfo beginInfo{
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+    };
+    err = vkBeginCommandBuffer(batch.commandBuffer, &beginInfo);
+    if (err != VkResult::VK_SUCCESS)
+    {
+        idle.push_back(batch);
+        return err;
+    }
+
+    // Consecutive copies into the same buffer go out as one vkCmdCopyBuffer
+    std::vector<VkBufferCopy> regions;
+    for (size_t i = 0; i < copies.size(); ++i)
+    {
+        regions.push_back(copies[i].region);
+        if (i + 1 == copies.size() || copies[i + 1].dst != copies[i].dst)
+        {
+            vkCmdCopyBuffer(batch.commandBuffer, buffer, copies[i].dst, static_cast<uint32_t>(regions.size()), regions.data());
+            regions.clear();
+        }
+    }
+    err = vkEndCommandBuffer(batch.commandBuffer);
+    if (err != VkResult::VK_SUCCESS)
+    {
+        idle.push_back(batch);
+        return err;
+    }
+
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &batch.commandBuffer;
+    err = vkQueueSubmit(queue, 1, &submitInfo, batch.fence);
+    if (err != VkResult::VK_SUCCESS)
+    {
+        idle.push_back(batch);
+        return err;
+    }
+
+    batch.ticket = ++submitted;
+    batch.end = head;
+    inFlight.push_back(batch);
+    copies.clear();
+    batchBegin = head;
+    ++batchCount;
+    ticket = batch.ticket;
+    return VkResult::VK_SUCCESS;
+}
+
+VkResult UploadManager::RetireOldest(VkDevice device, bool wait)
+{
+    if (inFlight.empty())
+    {
+        return VkResult::VK_SUCCESS;
+    }
+    Batch batch = inFlight.front();
+    VkResult err = wait ? vkWaitForFences(device, 1, &batch.fence, VK_TRUE, UINT64_MAX) : vkGetFenceStatus(device, batch.fence);
+    if (err != VkResult::VK_SUCCESS)
+    {
+        return err;
+    }
+    inFlight.pop_front();
+    // Batches are retired in submission order, so tail and completed only move forward
+    tail = batch.end;
+    completed = batch.ticket;
+    idle.push_back(batch);
+    return VkResult::VK_SUCCESS;
+}
+
+bool UploadManager::IsComplete(VkDevice device, UploadTicket ticket)
+{
+    while (!inFlight.empty() && RetireOldest(device, false) == VkResult::VK_SUCCESS)
+    {
+    }
+    return ticket <= completed;
+}
+
+VkResult UploadManager::Wait(VkDevice device, UploadTicket ticket)
+{
+    while (completed < ticket && !inFlight.empty())
+    {
+        VkResult err = RetireOldest(device, true);
+        if (err != VkResult::VK_SUCCESS)
+        {
+            return err;
+        }
+    }
+    return ticket <= completed ? VkResult::VK_SUCCESS : VkResult::VK_NOT_READY;
+}
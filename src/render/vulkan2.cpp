@@ -1379,16 +1379,6 @@ VkResult Renderer::CreateDescriptorSets()
     return VkResult::VK_SUCCESS;
 }
 
-struct ActiveSample
-{
-    glm::vec3 v;
-    glm::quat q;
-    float vTime;
-    float qTime;
-
-    ActiveSample() : v(0.0f), q(0.0f, 0.0f, 0.0f, 1.0f), vTime(-1.0f), qTime(-1.0f) {}
-};
-
 static void SetGlobalTransforms(JointTransform *transforms, const TTH::Skeleton &skeleton, size_t childIndex)
 {
     glm::mat4 localTransform = transforms[childIndex].transform;
@@ -1419,190 +1409,30 @@ VkResult Renderer::UpdateUniformBuffer(uint32_t currentImage)
         time = 0.0f;
     }
 
-    /* Animation, doing it like telltale even though it is a horrible way of doing it, but unlike telltale, I am using step interpolation for simplicity */
-    const TTH::CompressedSkeletonPoseKeys2 *cspk = nullptr;
-    for (int32_t i = 0; i < animation.mInterfaceCount && cspk == nullptr; ++i)
-    {
-        cspk = animation.mValues[i].GetTypePtr<TTH::CompressedSkeletonPoseKeys2>();
-    }
-    if (cspk == nullptr)
+    if (streamAnimation)
     {
-        return VkResult::VK_ERROR_UNKNOWN;
-    }
-
-    TTH::CompressedSkeletonPoseKeys2::Header header = *(TTH::CompressedSkeletonPoseKeys2::Header *)(cspk->mpData); // TODO: undefined behaviour? Should probably fix
-    const uint8_t *cspkBuf = cspk->mpData + sizeof(header) + sizeof(int64_t);
-
-    header.mRangeVector.x *= 9.536752e-07f;
-    header.mRangeVector.y *= 2.384186e-07f;
-    header.mRangeVector.z *= 2.384186e-07f;
-
-    header.mRangeDeltaV.x *= 0.0009775171f;
-    header.mRangeDeltaV.y *= 0.0004885198f;
-    header.mRangeDeltaV.z *= 0.0004885198f;
-
-    header.mRangeDeltaQ.x *= 0.0009775171f;
-    header.mRangeDeltaQ.y *= 0.0004885198f;
-    header.mRangeDeltaQ.z *= 0.0004885198f;
-
-    size_t stagedDelQ = 4;
-    size_t stagedAbsQ = 4;
-    size_t stagedDelV = 4;
-    size_t stagedAbsV = 4;
-    glm::quat delQ[4];
-    glm::quat absQ[4];
-    glm::vec3 delV[4];
-    glm::vec3 absV[4];
-
-    ActiveSample *currentSamples = new ActiveSample[header.mBoneCount]();
-    ActiveSample *previousSamples = new ActiveSample[header.mBoneCount]();
-
-    for (const uint32_t *headerData = (uint32_t *)(cspkBuf + header.mSampleDataSize + header.mBoneCount * sizeof(uint64_t)); headerData < (uint32_t *)(cspk->mpData + cspk->mDataSize); ++headerData)
-    {
-        if ((*headerData & 0x40000000) == 0) // Vector
+        if (animationStream.Advance(time) != 0)
         {
-            previousSamples[(*headerData >> 0x10) & 0xfff].v = currentSamples[(*headerData >> 0x10) & 0xfff].v;
-            previousSamples[(*headerData >> 0x10) & 0xfff].vTime = currentSamples[(*headerData >> 0x10) & 0xfff].vTime;
-            if (previousSamples[(*headerData >> 0x10) & 0xfff].vTime > time)
-            {
-                break;
-            }
-            currentSamples[(*headerData >> 0x10) & 0xfff].vTime = (float)(*headerData & 0xffff) * 1.525902e-05 * header.mRangeTime;
-            if ((int32_t)*headerData < 0)
-            {
-                if (stagedDelV > 3)
-                {
-                    for (uint32_t i = 0; i < 4; ++i)
-                    {
-                        delV[i].x = (float)(((uint32_t *)cspkBuf)[i] & 0x3ff) * header.mRangeDeltaV.x + header.mMinDeltaV.x;
-                        delV[i].y = (float)(((uint32_t *)cspkBuf)[i] >> 10 & 0x7ff) * header.mRangeDeltaV.y + header.mMinDeltaV.y;
-                        delV[i].z = (float)(((uint32_t *)cspkBuf)[i] >> 21) * header.mRangeDeltaV.z + header.mMinDeltaV.z;
-                    }
-                    cspkBuf += 4 * sizeof(uint32_t);
-                    stagedDelV = 0;
-                }
-                if (1)
-                {
-                    delV[stagedDelV] += previousSamples[(*headerData >> 0x10) & 0xfff].v;
-                }
-                currentSamples[(*headerData >> 0x10) & 0xfff].v = delV[stagedDelV];
-                ++stagedDelV;
-            }
-            else
-            {
-                if (stagedAbsV > 3)
-                {
-                    for (uint32_t i = 0; i < 4; ++i)
-                    {
-                        absV[i].x = (float)(((((uint32_t *)cspkBuf)[4 + i] & 0x3ff) << 10) | (((uint32_t *)cspkBuf)[i] & 0x3ff)) * header.mRangeVector.x + header.mMinVector.x;
-                        absV[i].y = (float)(((((uint32_t *)cspkBuf)[4 + i] >> 10 & 0x7ff) << 11) | (((uint32_t *)cspkBuf)[i] >> 10 & 0x7ff)) * header.mRangeVector.y + header.mMinVector.y;
-                        absV[i].z = (float)(((((uint32_t *)cspkBuf)[4 + i] >> 21) << 11) | (((uint32_t *)cspkBuf)[i] >> 21)) * header.mRangeVector.z + header.mMinVector.z;
-                    }
-                    cspkBuf += 8 * sizeof(uint32_t);
-                    stagedAbsV = 0;
-                }
-                currentSamples[(*headerData >> 0x10) & 0xfff].v = absV[stagedAbsV];
-                ++stagedAbsV;
-            }
-        }
-        else // Quaternion
-        {
-            previousSamples[(*headerData >> 0x10) & 0xfff].q = currentSamples[(*headerData >> 0x10) & 0xfff].q;
-            previousSamples[(*headerData >> 0x10) & 0xfff].qTime = currentSamples[(*headerData >> 0x10) & 0xfff].qTime;
-            if (previousSamples[(*headerData >> 0x10) & 0xfff].qTime > time)
-            {
-                break;
-            }
-            currentSamples[(*headerData >> 0x10) & 0xfff].qTime = (float)(*headerData & 0xffff) * 1.525902e-05 * header.mRangeTime;
-            if ((int32_t)*headerData < 0)
-            {
-                if (stagedDelQ > 3)
-                {
-                    for (uint32_t i = 0; i < 4; ++i)
-                    {
-                        delQ[i].x = (float)(((uint32_t *)cspkBuf)[i] & 0x3ff) * header.mRangeDeltaQ.x + header.mMinDeltaQ.x;
-                        delQ[i].y = (float)(((uint32_t *)cspkBuf)[i] >> 10 & 0x7ff) * header.mRangeDeltaQ.y + header.mMinDeltaQ.y;
-                        delQ[i].z = (float)(((uint32_t *)cspkBuf)[i] >> 21) * header.mRangeDeltaQ.z + header.mMinDeltaQ.z;
-                        delQ[i].w = ((1.0 - delQ[i].x * delQ[i].x) - delQ[i].y * delQ[i].y) - delQ[i].z * delQ[i].z;
-
-                        if (delQ[i].w > 0.0f)
-                        {
-                            delQ[i].w = sqrtf(delQ[i].w);
-                        }
-                        else
-                        {
-                            delQ[i].w = 0.0f;
-                        }
-                    }
-                    cspkBuf += 4 * sizeof(uint32_t);
-                    stagedDelQ = 0;
-                }
-                if (1)
-                {
-                    delQ[stagedDelQ] *= previousSamples[(*headerData >> 0x10) & 0xfff].q;
-                }
-                currentSamples[(*headerData >> 0x10) & 0xfff].q = delQ[stagedDelQ];
-                ++stagedDelQ;
-            }
-            else
-            {
-                if (stagedAbsQ > 3)
-                {
-                    for (uint32_t i = 0; i < 4; ++i)
-                    {
-                        absQ[i].x = (float)(((((uint32_t *)cspkBuf)[4 + i] & 0x3ff) << 10) | (((uint32_t *)cspkBuf)[i] & 0x3ff)) * 1.3487e-06 - 0.7071068;
-                        absQ[i].y = (float)(((((uint32_t *)cspkBuf)[4 + i] >> 10 & 0x7ff) << 11) | (((uint32_t *)cspkBuf)[i] >> 10 & 0x7ff)) * 3.371749e-07 - 0.7071068;
-                        absQ[i].z = (float)(((((uint32_t *)cspkBuf)[4 + i] >> 21) << 11) | (((uint32_t *)cspkBuf)[i] >> 21)) * 3.371749e-07 - 0.7071068;
-                        absQ[i].w = ((1.0 - absQ[i].x * absQ[i].x) - absQ[i].y * absQ[i].y) - absQ[i].z * absQ[i].z;
-                        if (absQ[i].w > 0.0f)
-                        {
-                            absQ[i].w = sqrtf(absQ[i].w);
-                        }
-                        else
-                        {
-                            absQ[i].w = 0.0f;
-                        }
-                    }
-                    cspkBuf += 8 * sizeof(uint32_t);
-                    stagedAbsQ = 0;
-                }
-                uint32_t axisOrder = *headerData >> 0x1c & 3;
-                currentSamples[(*headerData >> 0x10) & 0xfff].q.x = *(((float *)absQ + (axisOrder ^ 1)) + 4 * stagedAbsQ);
-                currentSamples[(*headerData >> 0x10) & 0xfff].q.y = *(((float *)absQ + (axisOrder ^ 2)) + 4 * stagedAbsQ);
-                currentSamples[(*headerData >> 0x10) & 0xfff].q.z = *(((float *)absQ + (axisOrder ^ 3)) + 4 * stagedAbsQ);
-                currentSamples[(*headerData >> 0x10) & 0xfff].q.w = *(((float *)absQ + (axisOrder)) + 4 * stagedAbsQ);
-                ++stagedAbsQ;
-            }
+            return VkResult::VK_ERROR_UNKNOWN;
         }
+        animationStream.Sample(sampledTranslations.data(), sampledRotations.data());
+    }
+    else
+    {
+        animationTracks.Sample(time, sampledTranslations.data(), sampledRotations.data());
     }
-
-    cspkBuf = cspk->mpData + sizeof(header) + sizeof(int64_t) + header.mSampleDataSize;
 
     for (size_t i = 0; i < skeleton.mEntries.size(); ++i)
     {
         ubo->boneTransforms[i] = glm::translate(glm::mat4(1.0f), glm::vec3{skeleton.mEntries[i].mLocalPos.x, skeleton.mEntries[i].mLocalPos.y, skeleton.mEntries[i].mLocalPos.z}) *
                                  glm::toMat4(glm::quat{skeleton.mEntries[i].mLocalQuat.w, skeleton.mEntries[i].mLocalQuat.x, skeleton.mEntries[i].mLocalQuat.y, skeleton.mEntries[i].mLocalQuat.z});
         ubo->baseTransforms[i] = ubo->boneTransforms[i];
-        for (size_t j = 0; j < header.mBoneCount; ++j)
-        {
-            if (((uint64_t *)(cspkBuf))[j] == skeleton.mEntries[i].mJointName.mCrc64)
-            {
-                float length = sqrtf(skeleton.mEntries[i].mLocalPos.x * skeleton.mEntries[i].mLocalPos.x + skeleton.mEntries[i].mLocalPos.y * skeleton.mEntries[i].mLocalPos.y +
-                                     skeleton.mEntries[i].mLocalPos.z * skeleton.mEntries[i].mLocalPos.z);
-                ubo->boneTransforms[i] =
-                    glm::translate(glm::mat4(1.0f), glm::vec3{currentSamples[j].v.x * length, currentSamples[j].v.y * length, currentSamples[j].v.z * length}) * glm::toMat4(currentSamples[j].q);
-                printf("%d [%f,%f,%f] [%f,%f,%f]\n", i, ubo->boneTransforms[i][3][0], ubo->boneTransforms[i][3][1], ubo->boneTransforms[i][3][2], skeleton.mEntries[i].mLocalPos.x,
-                       skeleton.mEntries[i].mLocalPos.y, skeleton.mEntries[i].mLocalPos.z);
-                break;
-            }
-        }
-
-        if (i == 177)
+        int32_t track = boneBinding.trackIndices[i];
+        if (track != BoneBinding::UNANIMATED)
         {
-            Matrix<4, 4> *mat = (Matrix<4, 4> *)(&ubo->boneTransforms[i]);
-            glm::mat4x4 x = glm::translate(glm::mat4(1.0f), glm::vec3{skeleton.mEntries[i].mLocalPos.x, skeleton.mEntries[i].mLocalPos.y, skeleton.mEntries[i].mLocalPos.z}) *
-                            glm::toMat4(glm::quat{skeleton.mEntries[i].mLocalQuat.w, skeleton.mEntries[i].mLocalQuat.x, skeleton.mEntries[i].mLocalQuat.y, skeleton.mEntries[i].mLocalQuat.z});
-            Matrix<4, 4> *mat2 = (Matrix<4, 4> *)(&x);
+            float length = sqrtf(skeleton.mEntries[i].mLocalPos.x * skeleton.mEntries[i].mLocalPos.x + skeleton.mEntries[i].mLocalPos.y * skeleton.mEntries[i].mLocalPos.y +
+                                 skeleton.mEntries[i].mLocalPos.z * skeleton.mEntries[i].mLocalPos.z);
+            ubo->boneTransforms[i] = glm::translate(glm::mat4(1.0f), sampledTranslations[track] * length) * glm::toMat4(sampledRotations[track]);
         }
     }
     for (size_t i = 0; i < skeleton.mEntries.size(); ++i)
@@ -1616,9 +1446,6 @@ VkResult Renderer::UpdateUniformBuffer(uint32_t currentImage)
         }
     }
 
-    delete[] currentSamples;
-    delete[] previousSamples;
-
     return VkResult::VK_SUCCESS;
 }
 
@@ -1727,6 +1554,49 @@ VkResult Renderer::VulkanInit()
         return VkResult::VK_ERROR_LAYER_NOT_PRESENT;
     }
 
+    const TTH::CompressedSkeletonPoseKeys2 *cspk = nullptr;
+    for (int32_t i = 0; i < animation.mInterfaceCount && cspk == nullptr; ++i)
+    {
+        cspk = animation.mValues[i].GetTypePtr<TTH::CompressedSkeletonPoseKeys2>();
+    }
+    if (cspk == nullptr || animationStream.Open(*cspk, animation.mLength) != 0)
+    {
+        return VkResult::VK_ERROR_UNKNOWN;
+    }
+    streamAnimation = animationStream.GetKeyCount() * (sizeof(float) + sizeof(glm::quat)) > MAX_EXPANDED_CLIP_SIZE;
+    if (streamAnimation)
+    {
+        if (animationSeekIndex.Build(*cspk, animation.mLength, SEEK_KEY_INTERVAL, SEEK_TIME_INTERVAL) != 0)
+        {
+            return VkResult::VK_ERROR_UNKNOWN;
+        }
+        animationStream.seekIndex = &animationSeekIndex;
+    }
+    else
+    {
+        if (DecodeCSPK2(*cspk, animation.mLength, animationTracks) != 0)
+        {
+            return VkResult::VK_ERROR_UNKNOWN;
+        }
+        animationStream.Close();
+    }
+    const std::vector<uint64_t> &trackCRC64 = streamAnimation ? animationStream.boneCRC64 : animationTracks.boneCRC64;
+    sampledTranslations.assign(trackCRC64.size(), glm::vec3(0.0f));
+    sampledRotations.assign(trackCRC64.size(), glm::quat(1.0f, 0.0f, 0.0f, 0.0f));
+    if (!streamAnimation)
+    {
+        // Constant tracks are never sampled, their value is set once here
+        sampledTranslations = animationTracks.baseTranslations;
+        sampledRotations = animationTracks.baseRotations;
+    }
+
+    std::vector<uint64_t> boneCRC64(skeleton.mEntries.size());
+    for (size_t i = 0; i < skeleton.mEntries.size(); ++i)
+    {
+        boneCRC64[i] = skeleton.mEntries[i].mJointName.mCrc64;
+    }
+    boneBinding.Build(boneCRC64.data(), boneCRC64.size(), trackCRC64.data(), trackCRC64.size());
+
     VkApplicationInfo appInfo{};
     appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
     appInfo.pApplicationName = "Chimera";
@@ -1,5 +1,7 @@
 #include <algorithm>
 #include <assimp/Importer.hpp>
+#include <chrono>
+#include <cmath>
 #include <assimp/matrix4x4.h>
 #include <glm/ext/matrix_clip_space.hpp>
 #include <glm/ext/matrix_transform.hpp>
@@ -113,21 +115,61 @@ static constexpr VkFormat GetVkFormat(TTH::D3DMesh::GFXPlatformFormat format)
     return VkFormat::VK_FORMAT_UNDEFINED;
 }
 
+// Camera of the frame, the bone palette lives in its own storage buffer sized to the skeleton
 struct UniformBufferObject
 {
-    glm::mat4x4 baseTransforms[256];
-    glm::mat4x4 boneTransforms[256];
     glm::mat4x4 model;
     glm::mat4x4 view;
     glm::mat4x4 proj;
-    glm::mat4x4 vertexTransform;
-    int boneCount;
 };
 
-struct JointTransform
+// Recorded straight into the command buffer, it never changes so the recorded draws can be reused. Has to stay within the 128 bytes every device
+// guarantees.
+struct DrawPushConstants
 {
-    glm::mat4x4 transform;
+    uint32_t boneCount;
+    uint32_t drawBase; // Added to gl_InstanceIndex, only set when the draws are issued one by one
 };
+static_assert(sizeof(DrawPushConstants) <= 128);
+
+// Per-draw entry of drawDataBuffer, matches the std430 layout of DrawData in the vertex shader
+struct DrawData
+{
+    glm::vec4 positionOffset; // Dequantizes the part's positions, w unused
+    glm::vec4 positionScale;
+    glm::vec4 instanceOffset; // Added after skinning, spreads the copies of the benchmark scene
+};
+
+// All parts of a character are drawn with one pipeline, so their vertex buffers have to match attribute for attribute
+static bool HasSameVertexLayout(const TTH::D3DMesh &a, const TTH::D3DMesh &b)
+{
+    if (a.GetVertexBufferCount() != b.GetVertexBufferCount())
+    {
+        return false;
+    }
+    for (size_t i = 0; i < a.GetVertexBufferCount(); ++i)
+    {
+        size_t attributeCount = a.GetVertexBufferAttributeCount(i);
+        if (attributeCount != b.GetVertexBufferAttributeCount(i))
+        {
+            return false;
+        }
+        TTH::D3DMesh::AttributeDescription attributesA[32];
+        TTH::D3DMesh::AttributeDescription attributesB[32];
+        a.GetVertexBuffer(i, 0, 0, attributesA);
+        b.GetVertexBuffer(i, 0, 0, attributesB);
+        for (size_t j = 0; j < attributeCount; ++j)
+        {
+            if (attributesA[j].format != attributesB[j].format || attributesA[j].offset != attributesB[j].offset)
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static VkDeviceSize AlignUp(VkDeviceSize value, VkDeviceSize alignment) { return alignment > 1 ? (value + alignment - 1) / alignment * alignment : value; }
 
 struct SwapChainSupportDetails
 {
@@ -437,7 +479,17 @@ VkResult Renderer::CreateLogicalDevice(const QueueFamilyIndices &indices)
         ++index;
     }
 
+    // Many indirect draws per call, each picking its draw data through firstInstance. Both are optional, RecordDraws falls back to one call per draw.
+    VkPhysicalDeviceFeatures supportedFeatures;
+    vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+    multiDrawIndirect = supportedFeatures.multiDrawIndirect && supportedFeatures.drawIndirectFirstInstance;
+    maxDrawIndirectCount = multiDrawIndirect ? std::max(properties.limits.maxDrawIndirectCount, 1u) : 1;
+
     VkPhysicalDeviceFeatures features{};
+    features.multiDrawIndirect = multiDrawIndirect ? VK_TRUE : VK_FALSE;
+    features.drawIndirectFirstInstance = multiDrawIndirect ? VK_TRUE : VK_FALSE;
 
     VkDeviceCreateInfo createInfo{};
     createInfo.enabledExtensionCount = deviceExtensions.size();
@@ -474,12 +526,92 @@ VkShaderModule CreateShaderModule(VkDevice device, const char *bytecode, size_t
     return module;
 }
 
+// Pipeline state followed by the draws [first, last) of meshDraws, shared by the primary and the secondary recording paths
+void Renderer::RecordDraws(VkCommandBuffer commandBuffer, size_t first, size_t last)
+{
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
+
+    VkViewport viewport{};
+    viewport.x = 0.0f;
+    viewport.y = 0.0f;
+    viewport.width = (float)swapchainExtent.width;
+    viewport.height = (float)swapchainExtent.height;
+    viewport.minDepth = 0.0f;
+    viewport.maxDepth = 1.0f;
+    vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+
+    VkRect2D scissor{};
+    scissor.offset = {0, 0};
+    scissor.extent = swapchainExtent;
+    vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+    // Every part is skinned by the same palette, so the descriptor set is bound once for the whole character
+    uint32_t dynamicOffsets[2] = {uniformOffset, bonePaletteOffset};
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSet, 2, dynamicOffsets);
+
+    // Every mesh lives in the geometry arena, so its streams and indices are bound once and the draws only differ in their indirect command
+    VkBuffer vertexBuffers[32];
+    std::fill_n(vertexBuffers, 32, vertexBuffer);
+    vkCmdBindVertexBuffers(commandBuffer, 0, static_cast<uint32_t>(geometryArena.streamOffsets.size()), vertexBuffers, geometryArena.streamOffsets.data());
+    vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, geometryArena.indexType);
+
+    DrawPushConstants pushConstants{};
+    pushConstants.boneCount = static_cast<uint32_t>(character.GetBoneCount());
+    if (multiDrawIndirect)
+    {
+        vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(DrawPushConstants), &pushConstants);
+        for (size_t i = first; i < last; i += maxDrawIndirectCount)
+        {
+            uint32_t drawCount = static_cast<uint32_t>(std::min<size_t>(last - i, maxDrawIndirectCount));
+            vkCmdDrawIndexedIndirect(commandBuffer, indirectBuffer, i * sizeof(VkDrawIndexedIndirectCommand), drawCount, sizeof(VkDrawIndexedIndirectCommand));
+        }
+        return;
+    }
+    for (size_t i = first; i < last; ++i)
+    {
+        pushConstants.drawBase = static_cast<uint32_t>(i);
+        vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(DrawPushConstants), &pushConstants);
+        vkCmdDrawIndexedIndirect(commandBuffer, indirectBuffer, i * sizeof(VkDrawIndexedIndirectCommand), 1, sizeof(VkDrawIndexedIndirectCommand));
+    }
+}
+
+// Records the share of meshDraws that belongs to thread into its secondary command buffer for imageIndex and the current frame slot
+VkResult Renderer::RecordSecondaryCommandBuffer(uint32_t imageIndex, uint32_t thread)
+{
+    VkCommandBuffer commandBuffer = secondaryCommandBuffers[(imageIndex * MAX_FRAMES_IN_FLIGHT + currentFrameIndex) * recordThreads + thread];
+
+    VkCommandBufferInheritanceInfo inheritanceInfo{};
+    inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+    inheritanceInfo.renderPass = renderPass;
+    inheritanceInfo.subpass = 0;
+    inheritanceInfo.framebuffer = swapchainFramebuffers[imageIndex];
+
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+    beginInfo.pInheritanceInfo = &inheritanceInfo;
+
+    VkResult err = vkBeginCommandBuffer(commandBuffer, &beginInfo);
+    if (err != VkResult::VK_SUCCESS)
+    {
+        return err;
+    }
+    RecordDraws(commandBuffer, meshDraws.size() * thread / recordThreads, meshDraws.size() * (thread + 1) / recordThreads);
+    return vkEndCommandBuffer(commandBuffer);
+}
+
+// Records the draw of swapchain image imageIndex for the current frame slot. Nothing recorded here changes from frame to frame: the frame ring hands
+// out the same offsets every time a slot comes around, camera and palette are read from it and the per-draw data sits in device buffers.
+// With more than one record thread the draws are split into secondary command buffers recorded on the job system and executed inside the render pass.
 VkResult Renderer::RecordCommandBuffer(uint32_t imageIndex)
 {
+    auto start = std::chrono::steady_clock::now();
+    uint32_t slot = imageIndex * MAX_FRAMES_IN_FLIGHT + currentFrameIndex;
+    VkCommandBuffer commandBuffer = commandBuffers[slot];
     VkCommandBufferBeginInfo beginInfo{};
     beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
 
-    VkResult err = vkBeginCommandBuffer(commandBuffers[currentFrameIndex], &beginInfo);
+    VkResult err = vkBeginCommandBuffer(commandBuffer, &beginInfo);
     if (err != VkResult::VK_SUCCESS)
     {
         return err;
@@ -499,44 +631,45 @@ VkResult Renderer::RecordCommandBuffer(uint32_t imageIndex)
     renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
     renderPassInfo.pClearValues = clearValues.data();
 
-    vkCmdBeginRenderPass(commandBuffers[currentFrameIndex], &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
-
-    vkCmdBindPipeline(commandBuffers[currentFrameIndex], VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
-
-    VkViewport viewport{};
-    viewport.x = 0.0f;
-    viewport.y = 0.0f;
-    viewport.width = (float)swapchainExtent.width;
-    viewport.height = (float)swapchainExtent.height;
-    viewport.minDepth = 0.0f;
-    viewport.maxDepth = 1.0f;
-    vkCmdSetViewport(commandBuffers[currentFrameIndex], 0, 1, &viewport);
-
-    VkRect2D scissor{};
-    scissor.offset = {0, 0};
-    scissor.extent = swapchainExtent;
-    vkCmdSetScissor(commandBuffers[currentFrameIndex], 0, 1, &scissor);
-
-    VkDeviceSize offsets[32];
-    VkBuffer vertexBuffers[32];
-
-    offsets[0] = 0;
-    vertexBuffers[0] = vertexBuffer;
-    for (size_t i = 1; i < d3dmesh.GetVertexBufferCount(); ++i)
+    if (recordThreads <= 1)
     {
-        vertexBuffers[i] = vertexBuffer;
-        offsets[i] = d3dmesh.GetVertexBufferSize(i - 1) + offsets[i - 1];
+        vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+        RecordDraws(commandBuffer, 0, meshDraws.size());
+    }
+    else
+    {
+        // Thread t only ever records from recordPools[t * MAX_FRAMES_IN_FLIGHT + frame], so no pool is used by two jobs at once
+        std::vector<VkResult> results(recordThreads, VkResult::VK_SUCCESS);
+        jobSystem->ParallelFor(recordThreads, 1,
+                               [this, imageIndex, &results](uint32_t begin, uint32_t end)
+                               {
+                                   for (uint32_t thread = begin; thread < end; ++thread)
+                                   {
+                                       results[thread] = RecordSecondaryCommandBuffer(imageIndex, thread);
+                                   }
+                               });
+        for (VkResult result : results)
+        {
+            if (result != VkResult::VK_SUCCESS)
+            {
+                vkEndCommandBuffer(commandBuffer);
+                return result;
+            }
+        }
+        vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+        vkCmdExecuteCommands(commandBuffer, recordThreads, secondaryCommandBuffers.data() + slot * recordThreads);
     }
 
-    vkCmdBindVertexBuffers(commandBuffers[currentFrameIndex], 0, d3dmesh.GetVertexBufferCount(), vertexBuffers, offsets);
-    vkCmdBindIndexBuffer(commandBuffers[currentFrameIndex], indexBuffer, 0, VkIndexType::VK_INDEX_TYPE_UINT16);
-    // vkCmdDraw(commandBuffers[currentFrameIndex], d3dmesh.GetVertexCount(), 1, 0, 0);
-    vkCmdBindDescriptorSets(commandBuffers[currentFrameIndex], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSets[currentFrameIndex], 0, nullptr);
-    vkCmdDrawIndexed(commandBuffers[currentFrameIndex], d3dmesh.GetIndexCount(), 1, 0, 0, 0);
-
-    vkCmdEndRenderPass(commandBuffers[currentFrameIndex]);
+    vkCmdEndRenderPass(commandBuffer);
+    err = vkEndCommandBuffer(commandBuffer);
 
-    return vkEndCommandBuffer(commandBuffers[currentFrameIndex]);
+    // Recording happens per swapchain image and again after every invalidation, so the timing is only worth logging for the benchmark scene
+    if (benchmarkCopies > 0)
+    {
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        TTH_LOG_INFO("Recorded %zu draws for image %u on %u threads in %.3f ms\n", meshDraws.size(), imageIndex, recordThreads, elapsed.count());
+    }
+    return err;
 }
 
 VkResult Renderer::DrawFrame()
@@ -565,29 +698,47 @@ VkResult Renderer::DrawFrame()
         return err;
     }
 
-    err = vkResetCommandBuffer(commandBuffers[currentFrameIndex], 0);
+    // Written before recording, the dynamic offsets bound by the command buffer come from this frame's allocations
+    err = UpdateUniformBuffer();
     if (err != VkResult::VK_SUCCESS)
     {
         return err;
     }
-    err = RecordCommandBuffer(imageIndex);
+
+    // Only ever submitted from this frame slot, so the fence wait above guarantees it is no longer pending
+    uint32_t commandBufferIndex = imageIndex * MAX_FRAMES_IN_FLIGHT + currentFrameIndex;
+    if (!commandBuffersRecorded[commandBufferIndex])
+    {
+        err = vkResetCommandBuffer(commandBuffers[commandBufferIndex], 0);
+        if (err != VkResult::VK_SUCCESS)
+        {
+            return err;
+        }
+        err = RecordCommandBuffer(imageIndex);
+        if (err != VkResult::VK_SUCCESS)
+        {
+            return err;
+        }
+        commandBuffersRecorded[commandBufferIndex] = true;
+    }
+
+    // The first frames are prepared while the geometry is still on its way, returns right away once the upload has completed
+    err = uploadManager.Wait(device, geometryUpload);
     if (err != VkResult::VK_SUCCESS)
     {
         return err;
     }
 
-    UpdateUniformBuffer();
-
     VkSubmitInfo submitInfo{};
     submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 
-    VkSemaphore waitSemaphores[] = {imageAvailableSemaphores[currentFrameIndex], uniformBufferReadySemaphores[currentFrameIndex]};
-    VkPipelineStageFlags waitStages[] = {VkPipelineStageFlagBits::VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VkPipelineStageFlagBits::VK_PIPELINE_STAGE_TRANSFER_BIT};
-    submitInfo.waitSemaphoreCount = 2;
+    VkSemaphore waitSemaphores[] = {imageAvailableSemaphores[currentFrameIndex]};
+    VkPipelineStageFlags waitStages[] = {VkPipelineStageFlagBits::VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
+    submitInfo.waitSemaphoreCount = 1;
     submitInfo.pWaitSemaphores = waitSemaphores;
     submitInfo.pWaitDstStageMask = waitStages;
     submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &commandBuffers[currentFrameIndex];
+    submitInfo.pCommandBuffers = &commandBuffers[commandBufferIndex];
     VkSemaphore signalSemaphores[] = {renderFinishedSemaphores[currentFrameIndex]};
     submitInfo.signalSemaphoreCount = 1;
     submitInfo.pSignalSemaphores = signalSemaphores;
@@ -751,9 +902,77 @@ VkResult Renderer::RecreateSwapchain()
         return err;
     }
 
+    // Recorded draws point at the old framebuffers and extent, the image count may have changed too
+    return AllocateCommandBuffers();
+}
+
+VkResult Renderer::AllocateCommandBuffers()
+{
+    if (!commandBuffers.empty())
+    {
+        vkFreeCommandBuffers(device, commandPool, static_cast<uint32_t>(commandBuffers.size()), commandBuffers.data());
+    }
+    commandBuffers.assign(imageCount * MAX_FRAMES_IN_FLIGHT, VK_NULL_HANDLE);
+
+    VkCommandBufferAllocateInfo commandBufferAllocInfo{};
+    commandBufferAllocInfo.sType = VkStructureType::VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    commandBufferAllocInfo.commandPool = commandPool;
+    commandBufferAllocInfo.level = VkCommandBufferLevel::VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    commandBufferAllocInfo.commandBufferCount = static_cast<uint32_t>(commandBuffers.size());
+
+    VkResult err = vkAllocateCommandBuffers(device, &commandBufferAllocInfo, commandBuffers.data());
+    if (err != VkResult::VK_SUCCESS)
+    {
+        commandBuffers.clear();
+        return err;
+    }
+    InvalidateCommandBuffers();
+
+    // Every record thread gets one secondary buffer per swapchain image and frame slot, allocated from its pool for that slot. The previous set may have
+    // been allocated for a different image count.
+    std::vector<VkCommandBuffer> poolBuffers;
+    uint32_t previousImageCount = static_cast<uint32_t>(secondaryCommandBuffers.size() / (MAX_FRAMES_IN_FLIGHT * recordThreads));
+    commandBufferAllocInfo.level = VkCommandBufferLevel::VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+    commandBufferAllocInfo.commandBufferCount = imageCount;
+    for (uint32_t pool = 0; pool < recordPools.size(); ++pool)
+    {
+        uint32_t thread = pool / MAX_FRAMES_IN_FLIGHT;
+        uint32_t frame = pool % MAX_FRAMES_IN_FLIGHT;
+        if (previousImageCount > 0)
+        {
+            poolBuffers.resize(previousImageCount);
+            for (uint32_t image = 0; image < previousImageCount; ++image)
+            {
+                poolBuffers[image] = secondaryCommandBuffers[(image * MAX_FRAMES_IN_FLIGHT + frame) * recordThreads + thread];
+            }
+            vkFreeCommandBuffers(device, recordPools[pool], previousImageCount, poolBuffers.data());
+        }
+    }
+    secondaryCommandBuffers.assign(recordPools.empty() ? 0 : commandBuffers.size() * recordThreads, VK_NULL_HANDLE);
+    poolBuffers.resize(imageCount);
+    for (uint32_t pool = 0; pool < recordPools.size(); ++pool)
+    {
+        uint32_t thread = pool / MAX_FRAMES_IN_FLIGHT;
+        uint32_t frame = pool % MAX_FRAMES_IN_FLIGHT;
+        commandBufferAllocInfo.commandPool = recordPools[pool];
+        err = vkAllocateCommandBuffers(device, &commandBufferAllocInfo, poolBuffers.data());
+        if (err != VkResult::VK_SUCCESS)
+        {
+            return err;
+        }
+        for (uint32_t image = 0; image < imageCount; ++image)
+        {
+            secondaryCommandBuffers[(image * MAX_FRAMES_IN_FLIGHT + frame) * recordThreads + thread] = poolBuffers[image];
+        }
+    }
     return VkResult::VK_SUCCESS;
 }
 
+void Renderer::InvalidateCommandBuffers()
+{
+    commandBuffersRecorded.assign(commandBuffers.size(), false);
+}
+
 VkResult Renderer::CreateFramebuffers()
 {
 
@@ -782,6 +1001,7 @@ VkResult Renderer::CreateFramebuffers()
 
 VkResult Renderer::CreateGraphicsPipeline()
 {
+    InvalidateCommandBuffers();
     VkShaderModule vertShaderModule;
     VkShaderModule fragShaderModule;
 
@@ -839,20 +1059,22 @@ VkResult Renderer::CreateGraphicsPipeline()
     VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
     vertexInputInfo.sType = VkStructureType::VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
 
+    // Every part shares the first part's vertex layout, VulkanInit rejects characters where they differ
+    const TTH::D3DMesh &layoutMesh = *character.parts[0];
     VkVertexInputBindingDescription bindings[32];
     VkVertexInputAttributeDescription attributes[32];
 
-    vertexInputInfo.vertexBindingDescriptionCount = d3dmesh.GetVertexBufferCount();
+    vertexInputInfo.vertexBindingDescriptionCount = layoutMesh.GetVertexBufferCount();
     vertexInputInfo.pVertexBindingDescriptions = bindings; // Optional, vertex buffer stuff
-    vertexInputInfo.vertexAttributeDescriptionCount = d3dmesh.GetAttributeCount();
+    vertexInputInfo.vertexAttributeDescriptionCount = layoutMesh.GetAttributeCount();
     vertexInputInfo.pVertexAttributeDescriptions = attributes; // Optional, vertex buffer stuff
 
     uint32_t attributeIndex = 0;
     for (uint32_t i = 0; i < vertexInputInfo.vertexBindingDescriptionCount; ++i)
     {
         TTH::D3DMesh::AttributeDescription d3dAttributes[32];
-        d3dmesh.GetVertexBuffer(i, 0, 0, d3dAttributes);
-        size_t d3dAttributeCount = d3dmesh.GetVertexBufferAttributeCount(i);
+        layoutMesh.GetVertexBuffer(i, 0, 0, d3dAttributes);
+        size_t d3dAttributeCount = layoutMesh.GetVertexBufferAttributeCount(i);
         bindings[i].binding = i;
         bindings[i].stride = d3dAttributes[d3dAttributeCount - 1].offset + TTH::D3DMesh::GetFormatStride(d3dAttributes[d3dAttributeCount - 1].format);
         bindings[i].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
@@ -945,12 +1167,17 @@ VkResult Renderer::CreateGraphicsPipeline()
     depthStencil.front = {}; // Optional
     depthStencil.back = {};  // Optional
 
+    VkPushConstantRange pushConstantRange{};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = sizeof(DrawPushConstants);
+
     VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
     pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
     pipelineLayoutInfo.setLayoutCount = 1;                 // Optional
     pipelineLayoutInfo.pSetLayouts = &descriptorSetLayout; // Optional
-    pipelineLayoutInfo.pushConstantRangeCount = 0;         // Optional
-    pipelineLayoutInfo.pPushConstantRanges = nullptr;      // Optional
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
     VkResult err = vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &pipelineLayout);
     if (err != VK_SUCCESS)
     {
@@ -995,214 +1222,147 @@ VkResult Renderer::CreateGraphicsPipeline()
 
 VkResult Renderer::InitializeBuffers()
 {
-    TTH::D3DMesh::GFXPlatformFormat indexFormat;
-    const void *d3dIndices = d3dmesh.GetIndices(indexFormat, 0, 0);
-    VkBufferCreateInfo bufferInfo{
-        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
-        .size = d3dmesh.GetFormatStride(indexFormat) * d3dmesh.GetIndexCount(),
-        .usage = VkBufferUsageFlagBits::VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VkBufferUsageFlagBits::VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
-    };
-    VkDeviceSize indexBufferSize = bufferInfo.size;
-
-    VkResult err = vkCreateBuffer(device, &bufferInfo, nullptr, &indexBuffer);
-    if (err != VkResult::VK_SUCCESS)
-    {
-        return err;
-    }
-
-    bufferInfo.usage = VkBufferUsageFlagBits::VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VkBufferUsageFlagBits::VK_BUFFER_USAGE_TRANSFER_DST_BIT;
-    bufferInfo.size = 0;
-    for (size_t i = 0; i < d3dmesh.GetVertexBufferCount(); ++i)
-    {
-        bufferInfo.size += d3dmesh.GetVertexBufferSize(i);
-    }
-    VkDeviceSize vertexBufferSize = bufferInfo.size;
-
-    err = vkCreateBuffer(device, &bufferInfo, nullptr, &vertexBuffer);
-    if (err != VkResult::VK_SUCCESS)
-    {
-        return err;
-    }
-
-    bufferInfo.usage = VkBufferUsageFlagBits::VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VkBufferUsageFlagBits::VK_BUFFER_USAGE_TRANSFER_DST_BIT;
-    bufferInfo.size = sizeof(UniformBufferObject) * MAX_FRAMES_IN_FLIGHT;
-
-    err = vkCreateBuffer(device, &bufferInfo, nullptr, &uniformBuffer);
-    if (err != VkResult::VK_SUCCESS)
-    {
-        return err;
-    }
-
-    VkMemoryRequirements memRequirements[3];
-    vkGetBufferMemoryRequirements(device, indexBuffer, memRequirements);
-    vkGetBufferMemoryRequirements(device, vertexBuffer, memRequirements + 1);
-    vkGetBufferMemoryRequirements(device, uniformBuffer, memRequirements + 2);
-
-    VkMemoryAllocateInfo allocInfo{};
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.allocationSize = memRequirements[0].size + memRequirements[1].size + memRequirements[2].size;
-    assert(memRequirements[0].size % memRequirements[0].alignment == 0);
-    assert(memRequirements[1].size % memRequirements[1].alignment == 0);
-    assert(memRequirements[2].size % memRequirements[2].alignment == 0);
-    allocInfo.memoryTypeIndex = FindMemoryType(memRequirements[0].memoryTypeBits & memRequirements[1].memoryTypeBits & memRequirements[2].memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-
-    err = vkAllocateMemory(device, &allocInfo, nullptr, &deviceMemory);
-    if (err != VkResult::VK_SUCCESS)
-    {
-        return err;
-    }
-
-    err = vkBindBufferMemory(device, indexBuffer, deviceMemory, 0);
-    if (err != VkResult::VK_SUCCESS)
+    InvalidateCommandBuffers();
+    // Every part is packed into the geometry arena, so all draws share one vertex and one index buffer and are issued from the indirect buffer
+    if (!geometryArena.Build(character.parts.data(), character.GetPartCount()))
     {
-        return err;
-    }
-    err = vkBindBufferMemory(device, vertexBuffer, deviceMemory, memRequirements[0].size);
-    if (err != VkResult::VK_SUCCESS)
-    {
-        return err;
-    }
-    err = vkBindBufferMemory(device, uniformBuffer, deviceMemory, memRequirements[0].size + memRequirements[1].size);
-    if (err != VkResult::VK_SUCCESS)
-    {
-        return err;
-    }
-    bufferInfo.usage = VkBufferUsageFlagBits::VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-    if (bufferInfo.size < vertexBufferSize)
-    {
-        bufferInfo.size = vertexBufferSize;
-    }
-    if (bufferInfo.size < indexBufferSize)
-    {
-        bufferInfo.size = indexBufferSize;
+        TTH_LOG_ERROR("Character parts do not fit one geometry arena\n");
+        return VkResult::VK_ERROR_UNKNOWN;
     }
-    err = vkCreateBuffer(device, &bufferInfo, nullptr, &stagingBuffer);
-    if (err != VkResult::VK_SUCCESS)
+    meshDraws.assign(character.GetPartCount(), MeshDraw{});
+    for (size_t i = 0; i < character.GetPartCount(); ++i)
     {
-        return err;
+        const TTH::D3DMesh &mesh = *character.parts[i];
+        MeshDraw &draw = meshDraws[i];
+        draw.mesh = static_cast<uint32_t>(i);
+        const TTH::Vector3 *positionOffset = mesh.GetPositionOffset();
+        const TTH::Vector3 *positionScale = mesh.GetPositionScale();
+        draw.positionOffset = glm::vec4{positionOffset->x, positionOffset->y, positionOffset->z, 0.0f};
+        draw.positionScale = glm::vec4{positionScale->x, positionScale->y, positionScale->z, 0.0f};
     }
-    vkGetBufferMemoryRequirements(device, stagingBuffer, memRequirements);
 
-    allocInfo.allocationSize = memRequirements[0].size;
-    allocInfo.memoryTypeIndex = FindMemoryType(memRequirements[0].memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-    err = vkAllocateMemory(device, &allocInfo, nullptr, &hostMemory);
-    if (err != VkResult::VK_SUCCESS)
+    // Benchmark copies reuse the parts' geometry, only their offset differs. They are laid out on a square grid around the original.
+    uint32_t gridSize = static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<float>(benchmarkCopies + 1))));
+    for (uint32_t copy = 1; copy <= benchmarkCopies; ++copy)
     {
-        return err;
-    }
-
-    err = vkBindBufferMemory(device, stagingBuffer, hostMemory, 0);
-    if (err != VkResult::VK_SUCCESS)
-    {
-        return err;
+        for (size_t i = 0; i < character.GetPartCount(); ++i)
+        {
+            MeshDraw draw = meshDraws[i];
+            draw.instanceOffset = glm::vec4{(float)(copy % gridSize) - 0.5f * (gridSize - 1), (float)(copy / gridSize) - 0.5f * (gridSize - 1), 0.0f, 0.0f};
+            meshDraws.push_back(draw);
+        }
     }
 
-    err = vkMapMemory(device, hostMemory, 0, bufferInfo.size, 0, &stagingBufferMemory);
-    if (err != VkResult::VK_SUCCESS)
+    // Draw i reads drawData[i] through its firstInstance, or through the pushed drawBase when firstInstance has to stay 0
+    std::vector<VkDrawIndexedIndirectCommand> indirectCommands(meshDraws.size());
+    std::vector<DrawData> drawData(meshDraws.size());
+    for (size_t i = 0; i < meshDraws.size(); ++i)
     {
-        return err;
-    }
-
-    memcpy(stagingBufferMemory, d3dIndices, indexBufferSize);
-
-    VkCommandBufferAllocateInfo commandBufferAllocInfo{
-        .sType = VkStructureType::VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
-        .commandPool = transferPool,
-        .level = VkCommandBufferLevel::VK_COMMAND_BUFFER_LEVEL_PRIMARY,
-        .commandBufferCount = 1,
+        const MeshDraw &draw = meshDraws[i];
+        const ArenaMesh &mesh = geometryArena.meshes[draw.mesh];
+        indirectCommands[i] = VkDrawIndexedIndirectCommand{
+            .indexCount = mesh.indexCount,
+            .instanceCount = 1,
+            .firstIndex = mesh.firstIndex,
+            .vertexOffset = mesh.vertexOffset,
+            .firstInstance = multiDrawIndirect ? static_cast<uint32_t>(i) : 0,
+        };
+        drawData[i] = DrawData{draw.positionOffset, draw.positionScale, draw.instanceOffset};
+    }
+    drawDataSize = drawData.size() * sizeof(DrawData);
+    TTH_LOG_INFO("Geometry arena: %zu meshes, %llu index bytes, %llu vertex bytes, %zu draws\n", geometryArena.meshes.size(),
+                 static_cast<unsigned long long>(geometryArena.indexSize), static_cast<unsigned long long>(geometryArena.vertexSize), meshDraws.size());
+
+    VkBuffer *deviceBuffers[4] = {&indexBuffer, &vertexBuffer, &indirectBuffer, &drawDataBuffer};
+    VkDeviceSize bufferSizes[4] = {geometryArena.indexSize, geometryArena.vertexSize, indirectCommands.size() * sizeof(VkDrawIndexedIndirectCommand), drawDataSize};
+    VkBufferUsageFlags bufferUsages[4] = {
+        VkBufferUsageFlagBits::VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+        VkBufferUsageFlagBits::VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+        VkBufferUsageFlagBits::VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+        VkBufferUsageFlagBits::VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
     };
-
-    VkCommandBuffer commandBuffer;
-    err = vkAllocateCommandBuffers(device, &commandBufferAllocInfo, &commandBuffer);
-    if (err != VkResult::VK_SUCCESS)
-    {
-        return err;
-    }
-
-    VkCommandBufferBeginInfo beginInfo{
-        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
-        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+    VkBufferCreateInfo bufferInfo{
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
     };
-    err = vkBeginCommandBuffer(commandBuffer, &beginInfo);
-    if (err != VkResult::VK_SUCCESS)
-    {
-        return err;
-    }
 
-    VkBufferCopy copyRegion{};
-    copyRegion.srcOffset = 0; // Optional
-    copyRegion.dstOffset = 0; // Optional
-    copyRegion.size = indexBufferSize;
-    vkCmdCopyBuffer(commandBuffer, stagingBuffer, indexBuffer, 1, &copyRegion);
-    err = vkEndCommandBuffer(commandBuffer);
-    if (err != VkResult::VK_SUCCESS)
+    // Each buffer is sub-allocated on its own, so later assets land in the same device memory blocks instead of new allocations
+    MemoryAllocation *bufferMemory[4] = {&indexMemory, &vertexMemory, &indirectMemory, &drawDataMemory};
+    MemoryCategory bufferCategories[4] = {MemoryCategory::Index, MemoryCategory::Vertex, MemoryCategory::Indirect, MemoryCategory::Storage};
+    VkResult err;
+    for (size_t i = 0; i < 4; ++i)
     {
-        return err;
-    }
-
-    VkSubmitInfo submitInfo{};
-    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &commandBuffer;
-
-    err = vkQueueSubmit(transferQueue, 1, &submitInfo, VK_NULL_HANDLE);
-    if (err != VkResult::VK_SUCCESS)
-    {
-        return err;
-    }
-
-    TTH::D3DMesh::AttributeDescription d3dAttributes[32];
-    const void *d3dVertexData = d3dmesh.GetVertexBuffer(0, 0, 0, d3dAttributes);
-
-    err = vkQueueWaitIdle(transferQueue);
-    if (err != VkResult::VK_SUCCESS)
-    {
-        return err;
+        bufferInfo.size = bufferSizes[i];
+        bufferInfo.usage = bufferUsages[i] | VkBufferUsageFlagBits::VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+        err = vkCreateBuffer(device, &bufferInfo, nullptr, deviceBuffers[i]);
+        if (err != VkResult::VK_SUCCESS)
+        {
+            return err;
+        }
+        err = allocator.AllocateBuffer(device, *deviceBuffers[i], VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, bufferCategories[i], *bufferMemory[i]);
+        if (err != VkResult::VK_SUCCESS)
+        {
+            return err;
+        }
     }
 
-    memcpy(stagingBufferMemory, d3dVertexData, vertexBufferSize);
-
-    err = vkBeginCommandBuffer(commandBuffer, &beginInfo);
+    // Every frame takes one uniform block and one bone palette from the ring, each at the device's offset alignment for dynamic offsets
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+    uniformAlignment = properties.limits.minUniformBufferOffsetAlignment;
+    storageAlignment = properties.limits.minStorageBufferOffsetAlignment;
+    bonePaletteSize = std::max<size_t>(character.GetBoneCount(), 1) * BONE_PALETTE_ENTRY_SIZE;
+    VkDeviceSize frameSize = AlignUp(sizeof(UniformBufferObject), storageAlignment) + bonePaletteSize;
+    err = frameRing.Init(device, allocator, frameSize, MAX_FRAMES_IN_FLIGHT,
+                         VkBufferUsageFlagBits::VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VkBufferUsageFlagBits::VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
     if (err != VkResult::VK_SUCCESS)
     {
         return err;
     }
+    TTH_LOG_INFO("Frame ring: %llu bytes per frame in %s memory\n", static_cast<unsigned long long>(frameRing.frameSize), frameRing.deviceLocal ? "device local" : "host");
 
-    copyRegion.size = vertexBufferSize;
-    vkCmdCopyBuffer(commandBuffer, stagingBuffer, vertexBuffer, 1, &copyRegion);
-    err = vkEndCommandBuffer(commandBuffer);
+    // Everything is queued on the staging ring and goes out in as few transfer submits as the ring allows. Nothing waits here, DrawFrame waits for
+    // the ticket before the first submit that reads these buffers.
+    err = geometryArena.Upload(device, character.parts.data(), uploadManager, indexBuffer, vertexBuffer);
     if (err != VkResult::VK_SUCCESS)
     {
         return err;
     }
-
-    err = vkQueueSubmit(transferQueue, 1, &submitInfo, VK_NULL_HANDLE);
+    err = uploadManager.Upload(device, indirectBuffer, 0, indirectCommands.data(), bufferSizes[2]);
     if (err != VkResult::VK_SUCCESS)
     {
         return err;
     }
-
-    err = vkQueueWaitIdle(transferQueue);
+    err = uploadManager.Upload(device, drawDataBuffer, 0, drawData.data(), bufferSizes[3]);
     if (err != VkResult::VK_SUCCESS)
     {
         return err;
     }
-
-    vkFreeCommandBuffers(device, transferPool, 1, &commandBuffer);
-    return VkResult::VK_SUCCESS;
+    return uploadManager.Submit(device, geometryUpload);
 }
 
 VkResult Renderer::CreateDescriptorSetLayout()
 {
-    VkDescriptorSetLayoutBinding bindings[1] = {0};
+    VkDescriptorSetLayoutBinding bindings[3] = {0};
 
     bindings[0].binding = 0;
-    bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    bindings[0].descriptorCount = 1; // USE THIS FOR SKELETON ANIMATION
+    bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    bindings[0].descriptorCount = 1;
     bindings[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
     bindings[0].pImmutableSamplers = nullptr; // Optional
 
+    bindings[1].binding = 1;
+    bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+    bindings[1].descriptorCount = 1; // Bone palette
+    bindings[1].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+    bindings[1].pImmutableSamplers = nullptr; // Optional
+
+    bindings[2].binding = 2;
+    bindings[2].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    bindings[2].descriptorCount = 1; // Draw data, indexed by instance
+    bindings[2].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+    bindings[2].pImmutableSamplers = nullptr; // Optional
+
     VkDescriptorSetLayoutCreateInfo layoutInfo{};
     layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
     layoutInfo.bindingCount = sizeof(bindings) / sizeof(bindings[0]);
@@ -1213,183 +1373,135 @@ VkResult Renderer::CreateDescriptorSetLayout()
 
 VkResult Renderer::CreateDescriptorPool()
 {
-    VkDescriptorPoolSize poolSize{
-        .type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-        .descriptorCount = MAX_FRAMES_IN_FLIGHT,
+    VkDescriptorPoolSize poolSizes[3] = {
+        {
+            .type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+            .descriptorCount = 1,
+        },
+        {
+            .type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC,
+            .descriptorCount = 1,
+        },
+        {
+            .type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .descriptorCount = 1,
+        },
     };
 
     VkDescriptorPoolCreateInfo poolInfo{
         .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
         .pNext = nullptr,
         .flags = 0,
-        .maxSets = MAX_FRAMES_IN_FLIGHT,
-        .poolSizeCount = 1,
-        .pPoolSizes = &poolSize,
+        .maxSets = 1,
+        .poolSizeCount = 3,
+        .pPoolSizes = poolSizes,
     };
 
     return vkCreateDescriptorPool(device, &poolInfo, nullptr, &descriptorPool);
 }
 
+// A single set covers every frame, the frame's ranges in the ring are selected with dynamic offsets when binding
 VkResult Renderer::CreateDescriptorSets()
 {
-    std::vector<VkDescriptorSetLayout> layouts(MAX_FRAMES_IN_FLIGHT, descriptorSetLayout);
+    InvalidateCommandBuffers();
     VkDescriptorSetAllocateInfo allocInfo{
         .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
         .pNext = nullptr,
         .descriptorPool = descriptorPool,
-        .descriptorSetCount = static_cast<uint32_t>(descriptorSets.size()),
-        .pSetLayouts = layouts.data(),
+        .descriptorSetCount = 1,
+        .pSetLayouts = &descriptorSetLayout,
     };
 
-    VkResult err = vkAllocateDescriptorSets(device, &allocInfo, descriptorSets.data());
+    VkResult err = vkAllocateDescriptorSets(device, &allocInfo, &descriptorSet);
     if (err != VkResult::VK_SUCCESS)
     {
         return err;
     }
 
-    for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
-    {
-        VkDescriptorBufferInfo bufferInfo{
-            .buffer = uniformBuffer,
-            .offset = i * sizeof(UniformBufferObject),
+    VkDescriptorBufferInfo bufferInfos[3] = {
+        {
+            .buffer = frameRing.buffer,
+            .offset = 0,
             .range = sizeof(UniformBufferObject),
-        };
+        },
+        {
+            .buffer = frameRing.buffer,
+            .offset = 0,
+            .range = bonePaletteSize,
+        },
+        {
+            .buffer = drawDataBuffer,
+            .offset = 0,
+            .range = drawDataSize,
+        },
+    };
+    VkDescriptorType descriptorTypes[3] = {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER};
 
-        VkWriteDescriptorSet descriptorWrite{
+    VkWriteDescriptorSet descriptorWrites[3];
+    for (uint32_t binding = 0; binding < 3; ++binding)
+    {
+        descriptorWrites[binding] = VkWriteDescriptorSet{
             .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
             .pNext = nullptr,
-            .dstSet = descriptorSets[i],
-            .dstBinding = 0,
+            .dstSet = descriptorSet,
+            .dstBinding = binding,
             .dstArrayElement = 0,
             .descriptorCount = 1,
-            .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+            .descriptorType = descriptorTypes[binding],
             .pImageInfo = nullptr,
-            .pBufferInfo = &bufferInfo,
+            .pBufferInfo = &bufferInfos[binding],
             .pTexelBufferView = nullptr,
         };
-
-        vkUpdateDescriptorSets(device, 1, &descriptorWrite, 0, nullptr);
     }
 
+    vkUpdateDescriptorSets(device, 3, descriptorWrites, 0, nullptr);
     return VkResult::VK_SUCCESS;
 }
 
-static void SetGlobalTransforms(JointTransform *transforms, TTH::Skeleton skeleton, size_t childIndex)
+// Writes straight into this frame's part of the frame ring, the fence of the frame that used it last has already been waited on
+VkResult Renderer::UpdateUniformBuffer()
 {
-    glm::mat4 localTransform = transforms[childIndex].transform;
-    transforms[childIndex].transform = glm::mat4(0.0f);
-    if (skeleton.GetBoneParentIndex(childIndex) >= 0)
+    frameRing.BeginFrame(currentFrameIndex);
+    VkDeviceSize offset;
+    UniformBufferObject *ubo = static_cast<UniformBufferObject *>(frameRing.Allocate(sizeof(UniformBufferObject), uniformAlignment, offset));
+    if (ubo == nullptr)
     {
-        glm::mat4 parentGlobalTransform;
-        SetGlobalTransforms(transforms, skeleton, skeleton.GetBoneParentIndex(childIndex));
-        transforms[childIndex].transform *= parentGlobalTransform;
+        return VK_ERROR_OUT_OF_DEVICE_MEMORY;
     }
-    transforms[childIndex].transform *= localTransform;
-}
+    uniformOffset = static_cast<uint32_t>(offset);
 
-VkResult Renderer::UpdateUniformBuffer()
-{
-    UniformBufferObject *ubo = static_cast<UniformBufferObject *>(stagingBufferMemory) + currentFrameIndex;
     ubo->model = glm::rotate(glm::mat4(1.0f), time * glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
     ubo->view = glm::lookAt(glm::vec3(2.0f, 2.0f, 2.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
     ubo->proj = glm::perspective(glm::radians(45.0f), swapchainExtent.width / (float)swapchainExtent.height, 0.1f, 10.0f);
-    const TTH::Vector3 *positionOffset = d3dmesh.GetPositionOffset();
-    const TTH::Vector3 *positionScale = d3dmesh.GetPositionScale();
-    ubo->vertexTransform = glm::translate(glm::mat4(1.0f), glm::vec3{positionOffset->x, positionOffset->y, positionOffset->z}) *
-                           glm::scale(glm::mat4(1.0f), glm::vec3{positionScale->x, positionScale->y, positionScale->z});
     ubo->proj[1][1] *= -1;
-    ubo->boneCount = skeleton.GetBoneCount();
 
     time += 0.001f;
     if (time > animation.GetDuration())
     {
         time = 0.0f;
-    }
-
-    for (int i = 0; i < ubo->boneCount; ++i)
-    {
-        const TTH::Vector3 *localPos = skeleton.GetBoneLocalPosition(i);
-        const TTH::Quaternion *localRot = skeleton.GetBoneLocalRotation(i);
-        ubo->boneTransforms[i] = glm::translate(glm::mat4(1.0f), glm::vec3{localPos->x, localPos->y, localPos->z}) * glm::toMat4(glm::quat{localRot->w, localRot->x, localRot->y, localRot->z});
-        ubo->baseTransforms[i] = ubo->boneTransforms[i];
-        const TTH::Symbol *animatedBoneNames = animation.GetBonesCRC64();
-        for (size_t j = 0; j < animation.GetBoneCount(); ++j)
+        if (skinPalette.totalBones > 0)
         {
-            if (animatedBoneNames[j] == skeleton.GetBoneCRC64(i))
-            {
-                animationRotations[j].mSamples.data();
-                animationTranslations[j].mSamples.data();
-                TTH::Quaternion quat;
-                TTH::Vector3 vec;
-                for (auto const &element : animationRotations[j].mSamples)
-                {
-                    quat = element.mValue;
-                    if (element.mTime > time)
-                    {
-                        break;
-                    }
-                }
-                for (auto const &element : animationTranslations[j].mSamples)
-                {
-                    vec = element.mValue;
-                    if (element.mTime > time)
-                    {
-                        break;
-                    }
-                }
-
-                float length = sqrtf(localPos->x * localPos->x + localPos->y * localPos->y + localPos->z * localPos->z);
-                ubo->boneTransforms[i] = glm::translate(glm::mat4(1.0f), glm::vec3{vec.x * length, vec.y * length, vec.z * length}) * glm::toMat4(glm::quat{quat.w, quat.x, quat.y, quat.z});
-                break;
-            }
-        }
-    }
-    for (int i = 0; i < ubo->boneCount; ++i)
-    {
-        if (skeleton.GetBoneParentIndex(i) >= 0)
-        {
-            assert(skeleton.GetBoneParentIndex(i) < i);
-            ubo->boneTransforms[i] = ubo->boneTransforms[skeleton.GetBoneParentIndex(i)] * ubo->boneTransforms[i];
-            ubo->baseTransforms[i] = ubo->baseTransforms[skeleton.GetBoneParentIndex(i)] * ubo->baseTransforms[i];
-            // printf("%ld [%f,%f,%f]\n", i, ubo->baseTransforms[i][3][0], ubo->baseTransforms[i][3][1], ubo->baseTransforms[i][3][2]);
+            TTH_LOG_INFO("Bone palette: %.1f%% of bone updates and %.1f%% of bone uploads skipped, last frame skipped %u and %u of %zu\n",
+                         100.0 * skinPalette.totalSkippedBones / skinPalette.totalBones, 100.0 * skinPalette.totalSkippedUploads / skinPalette.totalBones,
+                         skinPalette.skippedBones, skinPalette.skippedUploads, skinPalette.GetBoneCount());
         }
     }
 
-    VkCommandBufferBeginInfo beginInfo{
-        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
-        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
-    };
-    VkResult err = vkBeginCommandBuffer(uniformCommandBuffers[currentFrameIndex], &beginInfo);
-    if (err != VkResult::VK_SUCCESS)
+    float *palette = static_cast<float *>(frameRing.Allocate(bonePaletteSize, storageAlignment, offset));
+    if (palette == nullptr)
     {
-        return err;
+        return VK_ERROR_OUT_OF_DEVICE_MEMORY;
     }
+    bonePaletteOffset = static_cast<uint32_t>(offset);
 
-    VkBufferCopy copyRegion{};
-    copyRegion.srcOffset = sizeof(UniformBufferObject) * currentFrameIndex;
-    copyRegion.dstOffset = sizeof(UniformBufferObject) * currentFrameIndex;
-    copyRegion.size = sizeof(UniformBufferObject);
-    vkCmdCopyBuffer(uniformCommandBuffers[currentFrameIndex], stagingBuffer, uniformBuffer, 1, &copyRegion);
-    err = vkEndCommandBuffer(uniformCommandBuffers[currentFrameIndex]);
-    if (err != VkResult::VK_SUCCESS)
-    {
-        return err;
-    }
-
-    VkSubmitInfo submitInfo{};
-    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &uniformCommandBuffers[currentFrameIndex];
-    submitInfo.signalSemaphoreCount = 1;
-    submitInfo.pSignalSemaphores = uniformBufferReadySemaphores.data() + currentFrameIndex;
-
-    err = vkQueueSubmit(transferQueue, 1, &submitInfo, VK_NULL_HANDLE);
-    if (err != VkResult::VK_SUCCESS)
-    {
-        return err;
-    }
+    poseStage.Update(0.001f, jobSystem);
+    // Evaluated once for the character, every part reads the same palette. The bind pose is already folded in and the constant last row is dropped,
+    // so the palette is 48 bytes per bone of the skeleton. The frame's palette lands at the same ring offset every time it comes around, so only the
+    // bones that moved since this frame slot was last written are recomputed and rewritten.
+    skinPalette.Update(character.GetBonePalette(poseStage), character.inverseBindMatrices.data());
+    skinPalette.Write(currentFrameIndex, palette);
 
-    return VkResult::VK_SUCCESS;
+    return frameRing.Flush(device);
 }
 
 bool hasStencilComponent(VkFormat format) { return format == VK_FORMAT_D32_SFLOAT_S8_UINT || format == VK_FORMAT_D24_UNORM_S8_UINT; }
@@ -1417,8 +1529,8 @@ VkFormat Renderer::FindDepthFormat()
     return FindSupportedFormat({VK_FORMAT_D32_SFLOAT, VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D24_UNORM_S8_UINT}, VK_IMAGE_TILING_OPTIMAL, VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT);
 }
 
-VkResult Renderer::CreateImage(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage &image,
-                               VkDeviceMemory &imageMemory)
+VkResult Renderer::CreateImage(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties,
+                               MemoryCategory category, VkImage &image, MemoryAllocation &imageMemory)
 {
     VkImageCreateInfo imageInfo{};
     imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
@@ -1441,28 +1553,14 @@ VkResult Renderer::CreateImage(uint32_t width, uint32_t height, VkFormat format,
         return err;
     }
 
-    VkMemoryRequirements memRequirements;
-    vkGetImageMemoryRequirements(device, image, &memRequirements);
-
-    VkMemoryAllocateInfo allocInfo{};
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex = static_cast<uint32_t>(FindMemoryType(memRequirements.memoryTypeBits, properties));
-
-    err = vkAllocateMemory(device, &allocInfo, nullptr, &imageMemory);
-    if (err != VkResult::VK_SUCCESS)
-    {
-        return err;
-    }
-
-    return vkBindImageMemory(device, image, imageMemory, 0);
+    return allocator.AllocateImage(device, image, tiling, properties, category, imageMemory);
 }
 
 VkResult Renderer::CreateDepthResources()
 {
     VkFormat depthFormat = FindDepthFormat();
     VkResult err = CreateImage(swapchainExtent.width, swapchainExtent.height, depthFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-                               depthImage, depthImageMemory);
+                               MemoryCategory::Depth, depthImage, depthImageMemory);
     if (err != VkResult::VK_SUCCESS)
     {
         return err;
@@ -1498,9 +1596,106 @@ VkResult Renderer::VulkanInit()
         return VkResult::VK_ERROR_LAYER_NOT_PRESENT;
     }
 
-    animationRotations = new TTH::KeyframedValue<TTH::Quaternion>[animation.GetBoneCount()];
-    animationTranslations = new TTH::KeyframedValue<TTH::Vector3>[animation.GetBoneCount()];
-    animation.GetKeyframes(animationTranslations, animationRotations);
+    const TTH::CompressedSkeletonPoseKeys2 *cspk = nullptr;
+    for (int32_t i = 0; i < animation.mInterfaceCount && cspk == nullptr; ++i)
+    {
+        cspk = animation.mValues[i].GetTypePtr<TTH::CompressedSkeletonPoseKeys2>();
+    }
+    streamAnimation = false;
+    if (cspk != nullptr && animationStream.Open(*cspk, animation.GetDuration()) == 0)
+    {
+        streamAnimation = animationStream.GetKeyCount() * (sizeof(float) + sizeof(glm::quat)) > MAX_EXPANDED_CLIP_SIZE;
+    }
+    if (streamAnimation)
+    {
+        if (DescribeCSPK2(animationStream, animationTracks) < 0)
+        {
+            TTH_LOG_ERROR("Animation keys reference bones outside the clip\n");
+            return VkResult::VK_ERROR_UNKNOWN;
+        }
+        TTH_LOG_INFO("Streaming %zu animation keys instead of expanding them\n", animationStream.GetKeyCount());
+        // Reports its memory use once built
+        if (animationSeekIndex.Build(*cspk, animation.GetDuration(), SEEK_KEY_INTERVAL, SEEK_TIME_INTERVAL) < 0)
+        {
+            TTH_LOG_ERROR("Failed to build the animation seek index\n");
+            return VkResult::VK_ERROR_UNKNOWN;
+        }
+        animationStream.seekIndex = &animationSeekIndex;
+    }
+    else
+    {
+        animationStream.Close();
+        animationSeekIndex.Clear();
+        // CSPK2 clips are expanded straight from the bitstream, anything else goes through the keyframed values
+        if (cspk == nullptr)
+        {
+            BuildTracks(animation, animationTracks);
+        }
+        else if (DecodeCSPK2(*cspk, animation.GetDuration(), animationTracks) < 0)
+        {
+            TTH_LOG_ERROR("Failed to decode the animation keys\n");
+            return VkResult::VK_ERROR_UNKNOWN;
+        }
+        TTH_LOG_INFO("Expanded %zu translation and %zu rotation keys\n", animationTracks.translations.size(), animationTracks.rotations.size());
+    }
+    if (constantTrackTolerance >= 0.0f && !streamAnimation)
+    {
+        TrackFoldStats foldStats = FoldConstantTracks(animationTracks, constantTrackTolerance);
+        size_t constant = foldStats.keyedTracks - foldStats.animatedAfter;
+        TTH_LOG_INFO("%zu of %zu tracks constant (%.1f%%) and removed from sampling, %zu of them folded at tolerance %g\n", constant, foldStats.keyedTracks,
+                     foldStats.keyedTracks > 0 ? 100.0 * constant / foldStats.keyedTracks : 0.0, foldStats.animatedBefore - foldStats.animatedAfter, constantTrackTolerance);
+    }
+    if (bakeRate > 0.0f && !bakePoses && !streamAnimation)
+    {
+        if (BakeTracks(animationTracks, bakeRate, bakeFormat, bakedClip) < 0)
+        {
+            return VkResult::VK_ERROR_UNKNOWN;
+        }
+        TTH_LOG_INFO("Baked %u frames at %.1f Hz, %zu bytes\n", bakedClip.frameCount, bakeRate, bakedClip.GetMemoryUsage());
+    }
+    if (d3dmeshes.empty())
+    {
+        TTH_LOG_ERROR("Character needs at least one mesh part\n");
+        return VkResult::VK_ERROR_UNKNOWN;
+    }
+    character.Clear();
+    if (character.Build(skeleton, animationTracks) < 0)
+    {
+        TTH_LOG_ERROR("Skeleton hierarchy is not a tree\n");
+        return VkResult::VK_ERROR_UNKNOWN;
+    }
+    skinPalette.Reset(character.GetBoneCount(), MAX_FRAMES_IN_FLIGHT);
+    for (const TTH::D3DMesh &mesh : d3dmeshes)
+    {
+        if (!HasSameVertexLayout(d3dmeshes[0], mesh))
+        {
+            TTH_LOG_ERROR("Character parts have different vertex layouts\n");
+            return VkResult::VK_ERROR_UNKNOWN;
+        }
+        character.AddPart(mesh);
+    }
+    poseStage.Clear();
+    uint32_t poseInstance = character.AddToStage(poseStage, animationTracks);
+    TTH_LOG_INFO("Evaluating %zu of %zu bones\n", character.evaluatedHierarchy.GetBoneCount(), character.GetBoneCount());
+    if (streamAnimation)
+    {
+        poseStage.instances[poseInstance].stream = &animationStream;
+    }
+    else if (bakeRate > 0.0f && bakePoses)
+    {
+        // One sweep over the keys for every frame, only the bones the character evaluates are baked
+        if (BakePoses(animationTracks, character.evaluatedHierarchy, bakeRate, bakedPoses) < 0)
+        {
+            return VkResult::VK_ERROR_UNKNOWN;
+        }
+        TTH_LOG_INFO("Baked poses of %u frames at %.1f Hz, %zu bytes\n", bakedPoses.frameCount, bakeRate,
+                     (bakedPoses.localTransforms.size() + bakedPoses.globalTransforms.size()) * sizeof(glm::mat4));
+        poseStage.instances[poseInstance].bakedPoses = &bakedPoses;
+    }
+    else if (bakeRate > 0.0f)
+    {
+        poseStage.instances[poseInstance].bakedClip = &bakedClip;
+    }
 
     VkApplicationInfo appInfo{};
     appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
@@ -1554,6 +1749,7 @@ VkResult Renderer::VulkanInit()
     {
         return err;
     }
+    allocator.Init(physicalDevice);
 
     vkGetDeviceQueue(device, indices.graphicsFamily, 0, &graphicsQueue);
     vkGetDeviceQueue(device, indices.presentFamily, 0, &presentQueue);
@@ -1663,57 +1859,49 @@ VkResult Renderer::VulkanInit()
     {
         return err;
     }
-    poolInfo.queueFamilyIndex = indices.transferFamily;
-    err = vkCreateCommandPool(device, &poolInfo, nullptr, &transferPool);
-    if (err != VkResult::VK_SUCCESS)
+    recordThreads = jobSystem != nullptr ? std::max(recordThreadCount, 1u) : 1;
+    recordPools.assign(recordThreads > 1 ? recordThreads * MAX_FRAMES_IN_FLIGHT : 0, VK_NULL_HANDLE);
+    for (VkCommandPool &pool : recordPools)
     {
-        return err;
+        err = vkCreateCommandPool(device, &poolInfo, nullptr, &pool);
+        if (err != VkResult::VK_SUCCESS)
+        {
+            return err;
+        }
     }
-
-    err = InitializeBuffers();
+    poolInfo.queueFamilyIndex = indices.transferFamily;
+    err = vkCreateCommandPool(device, &poolInfo, nullptr, &transferPool);
     if (err != VkResult::VK_SUCCESS)
     {
         return err;
     }
-
-    err = CreateDescriptorPool();
+    err = uploadManager.Init(device, allocator, transferQueue, transferPool, uploadRingSize);
     if (err != VkResult::VK_SUCCESS)
     {
         return err;
     }
 
-    err = CreateDescriptorSets();
+    err = InitializeBuffers();
     if (err != VkResult::VK_SUCCESS)
     {
         return err;
     }
+    allocator.LogStats();
 
-    /* CommandBuffer */
-    VkCommandBufferAllocateInfo commandBufferAllocInfo{};
-    commandBufferAllocInfo.sType = VkStructureType::VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    commandBufferAllocInfo.commandPool = commandPool;
-    commandBufferAllocInfo.level = VkCommandBufferLevel::VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    commandBufferAllocInfo.commandBufferCount = MAX_FRAMES_IN_FLIGHT;
-
-    err = vkAllocateCommandBuffers(device, &commandBufferAllocInfo, commandBuffers.data());
+    err = CreateDescriptorPool();
     if (err != VkResult::VK_SUCCESS)
     {
         return err;
     }
 
-    commandBufferAllocInfo.commandPool = transferPool;
-    err = vkAllocateCommandBuffers(device, &commandBufferAllocInfo, uniformCommandBuffers.data());
+    err = CreateDescriptorSets();
     if (err != VkResult::VK_SUCCESS)
     {
         return err;
     }
 
-    VkCommandBufferBeginInfo beginInfo{};
-    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    beginInfo.flags = 0;                  // Optional
-    beginInfo.pInheritanceInfo = nullptr; // Optional
-
-    err = vkBeginCommandBuffer(commandBuffers[currentFrameIndex], &beginInfo);
+    /* CommandBuffer */
+    err = AllocateCommandBuffers();
     if (err != VkResult::VK_SUCCESS)
     {
         return err;
@@ -1740,11 +1928,6 @@ VkResult Renderer::VulkanInit()
         {
             return err;
         }
-        err = vkCreateSemaphore(device, &semaphoreInfo, nullptr, &uniformBufferReadySemaphores[i]);
-        if (err != VkResult::VK_SUCCESS)
-        {
-            return err;
-        }
 
         err = vkCreateFence(device, &fenceInfo, nullptr, &inFlightFences[i]);
         if (err != VkResult::VK_SUCCESS)
@@ -1760,10 +1943,9 @@ void Renderer::CleanupSwapchain()
 {
     vkDestroyImageView(device, depthImageView, nullptr);
     vkDestroyImage(device, depthImage, nullptr);
-    vkFreeMemory(device, depthImageMemory, nullptr);
+    allocator.Free(device, depthImageMemory);
     depthImageView = VK_NULL_HANDLE;
     depthImage = VK_NULL_HANDLE;
-    depthImageMemory = VK_NULL_HANDLE;
 
     for (uint32_t i = 0; i < imageCount; ++i)
     {
@@ -1783,34 +1965,42 @@ void Renderer::CleanupSwapchain()
 
 Renderer::~Renderer()
 {
-    vkFreeCommandBuffers(device, commandPool, MAX_FRAMES_IN_FLIGHT, commandBuffers.data());
-    vkFreeCommandBuffers(device, transferPool, MAX_FRAMES_IN_FLIGHT, uniformCommandBuffers.data());
+    if (!commandBuffers.empty())
+    {
+        vkFreeCommandBuffers(device, commandPool, static_cast<uint32_t>(commandBuffers.size()), commandBuffers.data());
+    }
     for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
     {
         vkDestroySemaphore(device, imageAvailableSemaphores[i], nullptr);
         vkDestroySemaphore(device, renderFinishedSemaphores[i], nullptr);
-        vkDestroySemaphore(device, uniformBufferReadySemaphores[i], nullptr);
         vkDestroyFence(device, inFlightFences[i], nullptr);
     }
 
+    uploadManager.Destroy(device, allocator);
     vkDestroyCommandPool(device, commandPool, nullptr);
     vkDestroyCommandPool(device, transferPool, nullptr);
+    // Frees the secondary command buffers with them
+    for (VkCommandPool pool : recordPools)
+    {
+        vkDestroyCommandPool(device, pool, nullptr);
+    }
     vkDestroyPipeline(device, graphicsPipeline, nullptr);
     vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
     vkDestroyRenderPass(device, renderPass, nullptr);
     CleanupSwapchain();
 
-    delete[] animationRotations;
-    delete[] animationTranslations;
-
-    vkDestroyBuffer(device, uniformBuffer, nullptr);
+    frameRing.Destroy(device, allocator);
     vkDestroyDescriptorPool(device, descriptorPool, nullptr);
     vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
     vkDestroyBuffer(device, indexBuffer, nullptr);
     vkDestroyBuffer(device, vertexBuffer, nullptr);
-    vkDestroyBuffer(device, stagingBuffer, nullptr);
-    vkFreeMemory(device, deviceMemory, nullptr);
-    vkFreeMemory(device, hostMemory, nullptr);
+    vkDestroyBuffer(device, indirectBuffer, nullptr);
+    vkDestroyBuffer(device, drawDataBuffer, nullptr);
+    allocator.Free(device, indexMemory);
+    allocator.Free(device, vertexMemory);
+    allocator.Free(device, indirectMemory);
+    allocator.Free(device, drawDataMemory);
+    allocator.Destroy(device);
     SDL_Vulkan_DestroySurface(instance, surface, nullptr);
     vkDestroyDevice(device, nullptr);
     vkDestroyInstance(instance, nullptr);